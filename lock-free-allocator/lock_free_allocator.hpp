@@ -0,0 +1,170 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <memory_resource>
+
+#include "../lock-free-memorypool/lock_free_memorypool.hpp"
+
+//general purpose small object allocator: one LockFreeMemoryPool per pow of 2 size class from 16 B to 4 KB
+//anything larger or aligned beyond 16 bytes goes to the global operator new
+//callers must hand the same size and alignment back to deallocate, as pmr and STL allocators do
+//a block has no header, the size passed back finds its class, and the pool keeps free list links in a side array,
+//so a class of S bytes occupies exactly S, plus 5 bytes of link and allocated flag per block outside the class's pages
+class LockFreeSlabAllocator : public std::pmr::memory_resource {
+
+private:
+
+    static constexpr size_t min_size = 16;
+    static constexpr size_t max_size = 4096;
+    static constexpr size_t block_align = 16;
+    static constexpr size_t class_count = 9;
+
+    static_assert((min_size << (class_count - 1)) == max_size, "size classes must cover min_size to max_size");
+
+    //Size is what the caller may use, the pool node is the block itself
+    template<size_t Size>
+    struct alignas(block_align) Block {
+        unsigned char bytes[Size];
+    };
+
+    template<size_t C>
+    using ClassPool = LockFreeMemoryPool<Block<(min_size << C)>>;
+
+    template<typename Seq>
+    struct PoolSet;
+
+    template<size_t... C>
+    struct PoolSet<std::index_sequence<C...>> {
+        using type = std::tuple<ClassPool<C>*...>;
+    };
+
+    typename PoolSet<std::make_index_sequence<class_count>>::type pools;
+
+private:
+
+    //-1 when the request has to go to the system
+    static int size_class(size_t bytes, size_t alignment) {
+        if (bytes > max_size || alignment > block_align) return -1;
+        if (bytes <= min_size) return 0;
+        return 64 - __builtin_clzll(bytes - 1) - __builtin_ctzll(min_size);
+    }
+
+    template<size_t C = 0>
+    void create_pools(uint32_t blocks, uint32_t magazine_size) {
+        std::get<C>(pools) = new ClassPool<C>(blocks, magazine_size);
+        if constexpr (C + 1 < class_count) create_pools<C + 1>(blocks, magazine_size);
+    }
+
+    template<size_t C = 0>
+    void delete_pools() {
+        delete std::get<C>(pools);
+        if constexpr (C + 1 < class_count) delete_pools<C + 1>();
+    }
+
+    template<size_t C = 0>
+    void* allocate_class(int c) {
+        if constexpr (C + 1 < class_count) {
+            if (c != int(C)) return allocate_class<C + 1>(c);
+        }
+        return std::get<C>(pools)->allocate();
+    }
+
+    template<size_t C = 0>
+    void deallocate_class(int c, void* ptr) {
+        if constexpr (C + 1 < class_count) {
+            if (c != int(C)) return deallocate_class<C + 1>(c, ptr);
+        }
+        std::get<C>(pools)->deallocate(static_cast<Block<(min_size << C)>*>(ptr));
+    }
+
+protected:
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        int c = size_class(bytes, alignment);
+        if (c < 0) return ::operator new(bytes, std::align_val_t(alignment));
+        void* ptr = allocate_class(c);
+        if (ptr == nullptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+        int c = size_class(bytes, alignment);
+        if (c < 0) {
+            ::operator delete(ptr, bytes, std::align_val_t(alignment));
+            return;
+        }
+        deallocate_class(c, ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+
+    LockFreeSlabAllocator() = delete;
+
+    LockFreeSlabAllocator(const LockFreeSlabAllocator&) = delete;
+
+    LockFreeSlabAllocator(const LockFreeSlabAllocator&&) = delete;
+
+    LockFreeSlabAllocator& operator = (const LockFreeSlabAllocator&) = delete;
+
+    LockFreeSlabAllocator& operator = (const LockFreeSlabAllocator&&) = delete;
+
+    //blocks is the first chunk of every size class pool, magazine_size is passed on to each pool
+    explicit LockFreeSlabAllocator(uint32_t blocks, uint32_t magazine_size = 0) {
+        assert(blocks > 0);
+        create_pools(blocks, magazine_size);
+    }
+
+    ~LockFreeSlabAllocator() {
+        delete_pools();
+    }
+};
+
+//STL allocator adapter, every rebound copy shares the same slab allocator
+template<typename T>
+class LockFreeStlAllocator {
+
+    template<typename U>
+    friend class LockFreeStlAllocator;
+
+private:
+
+    LockFreeSlabAllocator* slab;
+
+public:
+
+    using value_type = T;
+
+    LockFreeStlAllocator() = delete;
+
+    explicit LockFreeStlAllocator(LockFreeSlabAllocator* _slab) noexcept : slab(_slab) {}
+
+    template<typename U>
+    LockFreeStlAllocator(const LockFreeStlAllocator<U>& other) noexcept : slab(other.slab) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(slab->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        slab->deallocate(ptr, n * sizeof(T), alignof(T));
+    }
+
+    template<typename U>
+    bool operator == (const LockFreeStlAllocator<U>& other) const noexcept {
+        return slab == other.slab;
+    }
+
+    template<typename U>
+    bool operator != (const LockFreeStlAllocator<U>& other) const noexcept {
+        return slab != other.slab;
+    }
+};
\ No newline at end of file
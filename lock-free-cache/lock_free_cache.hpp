@@ -0,0 +1,240 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <optional>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "../lock-free-hashmap/lock_free_hashmap.hpp"
+#include "../lock-free-epoch/lock_free_epoch_reclaimer.hpp"
+
+//bounded cache: a LockFreeHashMap indexes entries, a CLOCK ring of capacity slots decides who gets evicted
+//a hit only sets the entry's reference bit, the hand clears bits until it finds an entry nobody touched since its last pass
+//misses are single flight: the first thread to miss a key loads it, everyone else missing it meanwhile parks on the entry's state
+//outside the epoch and looks the key up again once the load is done
+//evicted entries go back to the LockFreeMemoryPool once no reader in the epoch can still see them
+template<typename K, typename V>
+class LockFreeCache {
+
+private:
+
+    static constexpr size_t cache_line = 64;
+
+    static constexpr uint32_t loading = 0;
+    static constexpr uint32_t ready = 1;
+    static constexpr uint32_t failed = 2;
+    //set on a loading entry once somebody parks on it, the loader then wakes it
+    static constexpr uint32_t parked = 4;
+
+    struct Entry {
+        K key;
+        V value;
+        std::atomic<uint32_t> state;
+        std::atomic<bool> referenced;
+    };
+
+    uint32_t capacity;
+    std::atomic<Entry*>* ring;
+    alignas(cache_line) std::atomic<uint64_t> hand;
+
+    alignas(cache_line) std::atomic<uint64_t> hit_count;
+    alignas(cache_line) std::atomic<uint64_t> miss_count;
+    alignas(cache_line) std::atomic<uint64_t> eviction_count;
+
+    LockFreeHashMap<K, Entry*>* index;
+    LockFreeMemoryPool<Entry>* pool;
+    EpochReclaimer<Entry>* reclaimer;
+
+private:
+
+    static void futex_wait(std::atomic<uint32_t>* addr, uint32_t val) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t>* addr) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    //sleep until entry stops loading, runs outside the epoch
+    //entry may have been reclaimed meanwhile, pool memory stays mapped and every entry leaves loading through finish,
+    //so the worst case is waiting for an unrelated load before the caller looks the key up again
+    void park(Entry* entry) {
+        uint32_t state = entry->state.load(std::memory_order_acquire);
+        while ((state & ~parked) == loading) {
+            if (state == loading && !entry->state.compare_exchange_weak(state, loading | parked, std::memory_order_acq_rel)) continue;
+            futex_wait(&entry->state, loading | parked);
+            state = entry->state.load(std::memory_order_acquire);
+        }
+    }
+
+    //end a load with ready or failed and wake whoever parked on it
+    static void finish(Entry* entry, uint32_t state) {
+        if (entry->state.exchange(state, std::memory_order_acq_rel) & parked) futex_wake(&entry->state);
+    }
+
+    //give a freshly loaded entry a ring slot, evicting the first unreferenced entry under the hand if the ring is full
+    //the sweep runs in an epoch, a concurrent admitter may evict and retire a victim it is still looking at
+    void admit(Entry* entry) {
+        int e = reclaimer->enter();
+        while (true) {
+            uint32_t i = hand.fetch_add(1, std::memory_order_relaxed) % capacity;
+            Entry* victim = ring[i].load(std::memory_order_acquire);
+            if (victim == nullptr) {
+                if (ring[i].compare_exchange_strong(victim, entry, std::memory_order_acq_rel)) break;
+                continue;
+            }
+            if (victim->referenced.load(std::memory_order_relaxed)) {
+                victim->referenced.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            if (!ring[i].compare_exchange_strong(victim, entry, std::memory_order_acq_rel)) continue;
+            //single flight keeps one entry per key, so the mapping still points at the victim
+            index->remove(victim->key);
+            reclaimer->retire(victim);
+            eviction_count.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        reclaimer->leave(e);
+    }
+
+    //an entry still loading or failed reads as a miss instead of being waited for, must run inside an epoch
+    std::optional<V> peek(Entry* entry) {
+        if (entry->state.load(std::memory_order_acquire) != ready) return std::nullopt;
+        return touch(entry);
+    }
+
+    V touch(Entry* entry) {
+        if (!entry->referenced.load(std::memory_order_relaxed)) entry->referenced.store(true, std::memory_order_relaxed);
+        return entry->value;
+    }
+
+public:
+
+    LockFreeCache() = delete;
+
+    LockFreeCache(const LockFreeCache&) = delete;
+
+    LockFreeCache(const LockFreeCache&&) = delete;
+
+    LockFreeCache& operator = (const LockFreeCache&) = delete;
+
+    LockFreeCache& operator = (const LockFreeCache&&) = delete;
+
+    //_capacity is the number of entries kept, loads in flight come on top of it
+    explicit LockFreeCache(uint32_t _capacity) {
+        assert(_capacity > 0);
+        capacity = _capacity;
+        ring = new std::atomic<Entry*>[capacity]();
+        hand.store(0, std::memory_order_relaxed);
+        hit_count.store(0, std::memory_order_relaxed);
+        miss_count.store(0, std::memory_order_relaxed);
+        eviction_count.store(0, std::memory_order_relaxed);
+        index = new LockFreeHashMap<K, Entry*>(capacity);
+        pool = new LockFreeMemoryPool<Entry>(capacity);
+        reclaimer = new EpochReclaimer<Entry>(pool);
+    }
+
+    ~LockFreeCache() {
+        for (uint32_t i = 0; i < capacity; ++i) {
+            Entry* entry = ring[i].load(std::memory_order_acquire);
+            if (entry) pool->deallocate(entry);
+        }
+        delete[] ring;
+        delete index;
+        delete reclaimer;
+        delete pool;
+    }
+
+    //cached value of key, never loads and never waits, a key still being loaded by get_or_load is a miss
+    std::optional<V> get(const K& key) {
+        int e = reclaimer->enter();
+        std::optional<V> value;
+        std::optional<Entry*> entry = index->find(key);
+        if (entry) value = peek(*entry);
+        reclaimer->leave(e);
+        if (value) hit_count.fetch_add(1, std::memory_order_relaxed);
+        else miss_count.fetch_add(1, std::memory_order_relaxed);
+        return value;
+    }
+
+    //cached value of key, calling loader(key) on a miss, concurrent misses on the same key share one load
+    //if loader throws, the exception reaches the caller that ran it and the waiters retry
+    template<typename Loader>
+    V get_or_load(const K& key, Loader&& loader) {
+        reclaimer->collect();
+        while (true) {
+            int e = reclaimer->enter();
+            std::optional<Entry*> found = index->find(key);
+            if (found) {
+                std::optional<V> value = peek(*found);
+                reclaimer->leave(e);
+                if (value) {
+                    hit_count.fetch_add(1, std::memory_order_relaxed);
+                    return *value;
+                }
+                park(*found);
+                continue;
+            }
+
+            Entry* fresh = pool->allocate();
+            if (fresh == nullptr) {
+                std::cerr << "Memory allocation failed for lock free cache\n";
+                exit(0);
+            }
+            fresh->key = key;
+            fresh->state.store(loading, std::memory_order_relaxed);
+            fresh->referenced.store(false, std::memory_order_relaxed);
+            Entry* winner = nullptr;
+            index->compute(key, [&](Entry*& slot) {
+                if (slot == nullptr) slot = fresh;
+                winner = slot;
+            });
+            if (winner != fresh) {
+                //a waiter still holding an older incarnation of fresh may have parked on it
+                finish(fresh, failed);
+                pool->deallocate(fresh);
+                std::optional<V> value = peek(winner);
+                reclaimer->leave(e);
+                if (value) {
+                    hit_count.fetch_add(1, std::memory_order_relaxed);
+                    return *value;
+                }
+                park(winner);
+                continue;
+            }
+            //the entry is not in the ring while it loads, so it can not be evicted and needs no epoch
+            reclaimer->leave(e);
+
+            miss_count.fetch_add(1, std::memory_order_relaxed);
+            try {
+                fresh->value = loader(key);
+            }
+            catch (...) {
+                index->remove(key);
+                finish(fresh, failed);
+                reclaimer->retire(fresh);
+                throw;
+            }
+            V value = fresh->value;
+            finish(fresh, ready);
+            admit(fresh);
+            return value;
+        }
+    }
+
+    uint64_t hits() const {
+        return hit_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t misses() const {
+        return miss_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t evictions() const {
+        return eviction_count.load(std::memory_order_relaxed);
+    }
+};
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <iostream>
+#include <cstddef>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+//where a pool's chunks come from: the default is the global heap,
+//anything else maps anonymous memory, optionally huge page backed and bound to one NUMA node before it is touched
+class LockFreeMemoryBacking {
+
+public:
+
+    enum class Pages {
+        normal,
+        //madvise(MADV_HUGEPAGE), the kernel backs the region with huge pages when it can
+        transparent,
+        //MAP_HUGETLB from the reserved hugetlbfs pool, falls back to transparent when none are free
+        huge
+    };
+
+    static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+    Pages pages = Pages::normal;
+    //-1 leaves placement to the default policy
+    int numa_node = -1;
+
+    LockFreeMemoryBacking() = default;
+
+    LockFreeMemoryBacking(Pages _pages, int _numa_node = -1) : pages(_pages), numa_node(_numa_node) {}
+
+    //the heap is used, map and unmap are not called
+    bool is_heap() const {
+        return pages == Pages::normal && numa_node < 0;
+    }
+
+    //bytes is rounded up to the page size actually used, nullptr when the mapping fails
+    void* map(size_t& bytes) const {
+        size_t page = pages == Pages::normal ? size_t(sysconf(_SC_PAGESIZE)) : huge_page_size;
+        bytes = (bytes + page - 1) / page * page;
+        void* addr = MAP_FAILED;
+        if (pages == Pages::huge) {
+            addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (addr == MAP_FAILED) std::cerr << "MAP_HUGETLB failed for lock free pool, using transparent huge pages\n";
+        }
+        if (addr == MAP_FAILED) {
+            addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (addr == MAP_FAILED) return nullptr;
+            if (pages != Pages::normal) madvise(addr, bytes, MADV_HUGEPAGE);
+        }
+        if (numa_node >= 0) {
+            unsigned long mask[16] = {};
+            if (numa_node < int(sizeof(mask) * 8)) mask[numa_node / 64] = 1ul << (numa_node % 64);
+            if (syscall(SYS_mbind, addr, bytes, MPOL_BIND, mask, sizeof(mask) * 8, 0) != 0) {
+                std::cerr << "mbind failed for lock free pool, using the default policy\n";
+            }
+        }
+        return addr;
+    }
+
+    void unmap(void* addr, size_t bytes) const {
+        munmap(addr, bytes);
+    }
+};
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//head of an index linked free stack: a 32 bit slot index plus an ABA tag bumped by every successful swap
+//by default index and tag share one 64 bit word (32:32), so the tag wraps after 4G swaps instead of 64K
+//building with LOCK_FREE_DWCAS (and -mcx16 on x86-64) widens the tag to 64 bits and swaps both halves with cmpxchg16b
+class LockFreeTaggedHead {
+
+public:
+
+    static constexpr uint32_t null_index = 0xffffffffu;
+
+    struct Value {
+        uint32_t index;
+        uint64_t tag;
+    };
+
+private:
+
+#if defined(LOCK_FREE_DWCAS)
+
+#if !defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#error "LOCK_FREE_DWCAS needs a 16 byte compare and swap, build with -mcx16"
+#endif
+
+    alignas(16) unsigned __int128 word;
+
+    static unsigned __int128 pack(uint32_t index, uint64_t tag) {
+        return (static_cast<unsigned __int128>(tag) << 64) | index;
+    }
+
+    static Value unpack(unsigned __int128 combined) {
+        return {static_cast<uint32_t>(combined), static_cast<uint64_t>(combined >> 64)};
+    }
+
+public:
+
+    explicit LockFreeTaggedHead(uint32_t index = null_index) : word(pack(index, 0)) {}
+
+    //a 16 byte load is a locked cmpxchg16b as well, compare with 0 and write back 0 only when it already is 0
+    Value load() {
+        return unpack(__sync_val_compare_and_swap(&word, 0, 0));
+    }
+
+    //install index with expected.tag + 1, on failure expected is refreshed to the current head
+    bool compare_exchange(Value& expected, uint32_t index) {
+        unsigned __int128 old_word = pack(expected.index, expected.tag);
+        unsigned __int128 cur_word = __sync_val_compare_and_swap(&word, old_word, pack(index, expected.tag + 1));
+        if (cur_word == old_word) return true;
+        expected = unpack(cur_word);
+        return false;
+    }
+
+#else
+
+    std::atomic<uint64_t> word;
+
+    static uint64_t pack(uint32_t index, uint64_t tag) {
+        return (tag << 32) | index;
+    }
+
+    static Value unpack(uint64_t combined) {
+        return {static_cast<uint32_t>(combined), combined >> 32};
+    }
+
+public:
+
+    explicit LockFreeTaggedHead(uint32_t index = null_index) : word(pack(index, 0)) {}
+
+    Value load() {
+        return unpack(word.load(std::memory_order_acquire));
+    }
+
+    //install index with expected.tag + 1, on failure expected is refreshed to the current head
+    bool compare_exchange(Value& expected, uint32_t index) {
+        uint64_t old_word = pack(expected.index, expected.tag);
+        if (word.compare_exchange_strong(old_word, pack(index, expected.tag + 1), std::memory_order_acq_rel)) return true;
+        expected = unpack(old_word);
+        return false;
+    }
+
+#endif
+
+    LockFreeTaggedHead(const LockFreeTaggedHead&) = delete;
+
+    LockFreeTaggedHead& operator = (const LockFreeTaggedHead&) = delete;
+};
\ No newline at end of file
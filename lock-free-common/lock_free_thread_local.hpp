@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+//State kept per (owner object, thread) pair
+//a thread gets a record on its first get(), when the thread exits the owner's thread_exit(State&) runs on it
+//and the record is handed to the next thread that asks, records are only freed together with the registry
+//the owner must delete the registry before tearing down anything thread_exit touches
+//get() is a thread local lookup, the mutex is only taken on thread exit and registry destruction
+template<typename Owner, typename State>
+class LockFreeThreadLocal {
+
+public:
+
+    struct Record {
+        State state;
+        std::atomic<bool> active;
+        Record* next;
+    };
+
+private:
+
+    struct Control {
+        std::mutex lock;
+        Owner* owner;
+    };
+
+    struct Entry {
+        uint64_t id;
+        Record* record;
+        std::weak_ptr<Control> control;
+    };
+
+    struct ThreadCache {
+        std::vector<Entry> entries;
+
+        ~ThreadCache() {
+            for (Entry& entry : entries) {
+                std::shared_ptr<Control> control = entry.control.lock();
+                if (!control) continue;
+                std::lock_guard<std::mutex> guard(control->lock);
+                if (control->owner == nullptr) continue;
+                control->owner->thread_exit(entry.record->state);
+                entry.record->active.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    uint64_t id;
+    std::atomic<Record*> records;
+    std::shared_ptr<Control> control;
+
+private:
+
+    static ThreadCache& cache() {
+        static thread_local ThreadCache thread_cache;
+        return thread_cache;
+    }
+
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> ids(1);
+        return ids.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Record* acquire() {
+        for (Record* record = records.load(std::memory_order_acquire); record; record = record->next) {
+            bool inactive = false;
+            if (!record->active.load(std::memory_order_relaxed)
+                && record->active.compare_exchange_strong(inactive, true, std::memory_order_acq_rel)) {
+                return record;
+            }
+        }
+        Record* record = new Record();
+        record->active.store(true, std::memory_order_relaxed);
+        Record* head = records.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed) == false);
+        return record;
+    }
+
+    Record* attach() {
+        std::vector<Entry>& entries = cache().entries;
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& entry) {
+            return entry.control.expired();
+        }), entries.end());
+        Record* record = acquire();
+        entries.push_back({id, record, control});
+        return record;
+    }
+
+public:
+
+    LockFreeThreadLocal() = delete;
+
+    LockFreeThreadLocal(const LockFreeThreadLocal&) = delete;
+
+    LockFreeThreadLocal(const LockFreeThreadLocal&&) = delete;
+
+    LockFreeThreadLocal& operator = (const LockFreeThreadLocal&) = delete;
+
+    LockFreeThreadLocal& operator = (const LockFreeThreadLocal&&) = delete;
+
+    explicit LockFreeThreadLocal(Owner* owner) : id(next_id()), records(nullptr), control(std::make_shared<Control>()) {
+        control->owner = owner;
+    }
+
+    ~LockFreeThreadLocal() {
+        {
+            std::lock_guard<std::mutex> guard(control->lock);
+            control->owner = nullptr;
+        }
+        Record* record = records.load(std::memory_order_acquire);
+        while (record) {
+            Record* next = record->next;
+            delete record;
+            record = next;
+        }
+    }
+
+    State& get() {
+        std::vector<Entry>& entries = cache().entries;
+        for (Entry& entry : entries) {
+            if (entry.id == id) return entry.record->state;
+        }
+        return attach()->state;
+    }
+
+    //visit every record ever handed out, including ones parked by exited threads
+    template<typename Fn>
+    void for_each(Fn fn) {
+        for (Record* record = records.load(std::memory_order_acquire); record; record = record->next) {
+            fn(record->state);
+        }
+    }
+};
\ No newline at end of file
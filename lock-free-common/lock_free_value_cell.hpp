@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+//a value read and written in place by many threads, the access path depends on V:
+//trivially copyable values of 1, 2, 4 or 8 bytes (integers, pointers, small structs) go through atomic builtins
+//other trivially copyable values keep two copies, a writer fills the spare one and flips state to it,
+//readers copy the current one without waiting and retry when state moved on meanwhile (a seqlock that never blocks readers),
+//that copy may overlap a writer's memcpy of the same bytes, which the version check throws away
+//anything else is guarded by the writing bit of state and readers take it too, so a visit callback must not touch its own key
+//writers of the last two kinds serialize on the writing bit, a throwing fn releases it and leaves the value as it was
+template<typename V>
+class LockFreeValueCell {
+
+public:
+
+    static constexpr bool atomic = std::is_trivially_copyable<V>::value &&
+        (sizeof(V) == 1 || sizeof(V) == 2 || sizeof(V) == 4 || sizeof(V) == 8) && __atomic_always_lock_free(sizeof(V), 0);
+    static constexpr bool buffered = !atomic && std::is_trivially_copyable<V>::value;
+
+private:
+
+    //live is clear while a compute still runs on a fresh cell, readers treat it as missing
+    static constexpr uint32_t writing = 1;
+    static constexpr uint32_t live = 2;
+    static constexpr uint32_t current = 4;
+    static constexpr uint32_t version = 8;
+
+    //word sized values are aligned to their size so the builtins stay lock free
+    alignas(atomic ? sizeof(V) : alignof(V)) V values[buffered ? 2 : 1];
+    std::atomic<uint32_t> state;
+
+private:
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    //state before the writing bit was taken
+    uint32_t lock() {
+        uint32_t before = state.load(std::memory_order_relaxed);
+        while (true) {
+            if (before & writing) {
+                cpu_relax();
+                before = state.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (state.compare_exchange_weak(before, before | writing, std::memory_order_acquire, std::memory_order_relaxed)) return before;
+        }
+    }
+
+    void unlock(uint32_t before) {
+        state.store(before, std::memory_order_release);
+    }
+
+    //make the spare copy current
+    void publish(uint32_t before) {
+        state.store(((before ^ current) | live) + version, std::memory_order_release);
+    }
+
+    V& current_copy(uint32_t s) {
+        return values[buffered && (s & current) ? 1 : 0];
+    }
+
+    V& spare_copy(uint32_t s) {
+        return values[(s & current) ? 0 : 1];
+    }
+
+public:
+
+    //only while the cell is private to one thread, before its node is linked
+    void init(const V& value) {
+        values[0] = value;
+        state.store(live, std::memory_order_relaxed);
+    }
+
+    //first half of a compute on a fresh cell, before its node is linked
+    //word sized values run fn right here, the others stay locked and not live until complete
+    template<typename Fn>
+    void prepare(Fn& fn) {
+        values[0] = V();
+        if constexpr (atomic) {
+            fn(values[0]);
+            state.store(live, std::memory_order_relaxed);
+        }
+        else state.store(writing, std::memory_order_relaxed);
+    }
+
+    //second half, once the node is linked: fn runs exactly once, if it throws the cell goes live holding V()
+    template<typename Fn>
+    void complete(Fn& fn) {
+        if constexpr (buffered) {
+            values[1] = values[0];
+            try {
+                fn(values[1]);
+            }
+            catch (...) {
+                unlock(live);
+                throw;
+            }
+            publish(0);
+        }
+        else if constexpr (!atomic) {
+            try {
+                fn(values[0]);
+            }
+            catch (...) {
+                values[0] = V();
+                unlock(live);
+                throw;
+            }
+            unlock(live);
+        }
+    }
+
+    //false while a fresh cell is not live yet
+    bool load(V& out) {
+        if constexpr (atomic) {
+            __atomic_load(&values[0], &out, __ATOMIC_ACQUIRE);
+            return true;
+        }
+        else if constexpr (buffered) {
+            while (true) {
+                uint32_t before = state.load(std::memory_order_acquire);
+                if (!(before & live)) return false;
+                std::memcpy(static_cast<void*>(&out), &current_copy(before), sizeof(V));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                uint32_t after = state.load(std::memory_order_relaxed);
+                if (((before ^ after) & ~writing) == 0) return true;
+            }
+        }
+        else {
+            uint32_t before = lock();
+            try {
+                out = values[0];
+            }
+            catch (...) {
+                unlock(before);
+                throw;
+            }
+            unlock(before);
+            return true;
+        }
+    }
+
+    void store(const V& value) {
+        if constexpr (atomic) {
+            V copy = value;
+            __atomic_store(&values[0], &copy, __ATOMIC_RELEASE);
+        }
+        else if constexpr (buffered) {
+            uint32_t before = lock();
+            spare_copy(before) = value;
+            publish(before);
+        }
+        else {
+            uint32_t before = lock();
+            try {
+                values[0] = value;
+            }
+            catch (...) {
+                unlock(before);
+                throw;
+            }
+            unlock(before);
+        }
+    }
+
+    //fn(V&) on the value, word sized values are updated by CAS, there fn may run more than once and must only depend on its argument
+    template<typename Fn>
+    void apply(Fn& fn) {
+        if constexpr (atomic) {
+            V old;
+            __atomic_load(&values[0], &old, __ATOMIC_ACQUIRE);
+            V value;
+            do {
+                value = old;
+                fn(value);
+            } while (!__atomic_compare_exchange(&values[0], &old, &value, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        }
+        else if constexpr (buffered) {
+            uint32_t before = lock();
+            V& spare = spare_copy(before);
+            spare = current_copy(before);
+            try {
+                fn(spare);
+            }
+            catch (...) {
+                unlock(before);
+                throw;
+            }
+            publish(before);
+        }
+        else {
+            uint32_t before = lock();
+            try {
+                fn(values[0]);
+            }
+            catch (...) {
+                unlock(before);
+                throw;
+            }
+            unlock(before);
+        }
+    }
+
+    //fn(const V&) on a snapshot, or on the value itself under the writing bit when V is not trivially copyable
+    //false while a fresh cell is not live yet
+    template<typename Fn>
+    bool visit(Fn& fn) {
+        if constexpr (atomic || buffered) {
+            V value;
+            if (!load(value)) return false;
+            fn(static_cast<const V&>(value));
+            return true;
+        }
+        else {
+            uint32_t before = lock();
+            try {
+                fn(static_cast<const V&>(values[0]));
+            }
+            catch (...) {
+                unlock(before);
+                throw;
+            }
+            unlock(before);
+            return true;
+        }
+    }
+
+    template<typename U = V>
+    typename std::enable_if<std::is_integral<U>::value, V>::type fetch_add(V delta) {
+        return __atomic_fetch_add(&values[0], delta, __ATOMIC_ACQ_REL);
+    }
+
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <type_traits>
+#include <new>
+
+//work stealing deque (Chase & Lev) with the C11 orderings of Le, Pop, Cohen & Zappa Nardelli
+//one owner thread pushes and pops at the bottom, any thread may steal from the top
+//push is plain stores ending in a release store of bottom, pop adds one fence and only CASes when it races a thief for the last element,
+//steal is one CAS on top
+//the circular array doubles when full, old arrays may still be read by thieves so they are kept until the deque dies,
+//together they are never larger than the current one
+template<typename T>
+class LockFreeDeque {
+
+    static_assert(std::is_trivially_copyable<T>::value, "deque elements are copied racily and must be trivially copyable");
+
+private:
+
+    static constexpr size_t cache_line = 64;
+
+    struct Array {
+        int64_t mask;
+        std::atomic<T>* slots;
+        Array* retired;
+
+        T get(int64_t i) {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, const T& val) {
+            slots[i & mask].store(val, std::memory_order_relaxed);
+        }
+    };
+
+    alignas(cache_line) std::atomic<int64_t> top;
+    alignas(cache_line) std::atomic<int64_t> bottom;
+    std::atomic<Array*> array;
+
+private:
+
+    static Array* new_array(int64_t capacity) {
+        Array* a = new (std::nothrow) Array;
+        std::atomic<T>* slots = new (std::nothrow) std::atomic<T>[capacity];
+        if (a == nullptr || slots == nullptr) {
+            std::cerr << "Memory allocation failed for lock free deque\n";
+            exit(0);
+        }
+        a->mask = capacity - 1;
+        a->slots = slots;
+        a->retired = nullptr;
+        return a;
+    }
+
+    //owner only, copies [t, b) into an array twice the size, the old one is chained behind it
+    Array* grow(Array* a, int64_t t, int64_t b) {
+        Array* bigger = new_array((a->mask + 1) * 2);
+        for (int64_t i = t; i < b; ++i) {
+            bigger->put(i, a->get(i));
+        }
+        bigger->retired = a;
+        array.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+public:
+
+    LockFreeDeque() = delete;
+
+    LockFreeDeque(const LockFreeDeque&) = delete;
+
+    LockFreeDeque(const LockFreeDeque&&) = delete;
+
+    LockFreeDeque& operator = (const LockFreeDeque&) = delete;
+
+    LockFreeDeque& operator = (const LockFreeDeque&&) = delete;
+
+    //capacity is the initial array size rounded up to pow of 2, it grows on demand
+    explicit LockFreeDeque(uint32_t capacity) {
+        assert(capacity > 0 && capacity <= 0x80000000u);
+        int64_t size = capacity == 1 ? 1 : int64_t(1) << (64 - __builtin_clzll(uint64_t(capacity) - 1));
+        top.store(0, std::memory_order_relaxed);
+        bottom.store(0, std::memory_order_relaxed);
+        array.store(new_array(size), std::memory_order_relaxed);
+    }
+
+    ~LockFreeDeque() {
+        Array* a = array.load(std::memory_order_acquire);
+        while (a) {
+            Array* retired = a->retired;
+            delete[] a->slots;
+            delete a;
+            a = retired;
+        }
+    }
+
+    //owner only
+    void push(const T& val) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t > a->mask) a = grow(a, t, b);
+        a->put(b, val);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    //owner only, newest element first
+    bool pop(T& val) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        T x = a->get(b);
+        if (t == b) {
+            //the last element, thieves may be after it too
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won) return false;
+        }
+        val = x;
+        return true;
+    }
+
+    //any thread, oldest element first, false when empty or another thief or the owner got the element first
+    bool steal(T& val) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return false;
+        Array* a = array.load(std::memory_order_acquire);
+        T x = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return false;
+        val = x;
+        return true;
+    }
+
+    //a snapshot, exact only for the owner while nobody steals
+    bool empty() {
+        int64_t b = bottom.load(std::memory_order_acquire);
+        int64_t t = top.load(std::memory_order_acquire);
+        return t >= b;
+    }
+
+};
\ No newline at end of file
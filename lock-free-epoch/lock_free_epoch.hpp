@@ -0,0 +1,99 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+
+#include "../lock-free-common/lock_free_thread_local.hpp"
+
+//epoch based reclamation (Fraser): every thread registers one cache line padded slot the first time it enters
+//lockepoch publishes the global epoch in the thread's own slot, nothing shared is written on the read path
+//the global epoch only moves on once every thread inside a critical section has seen the current one,
+//so whatever was retired two epochs ago can no longer be reached by anybody
+class EpochManager {
+
+private:
+
+    static constexpr uint64_t access = -1ull;
+    //minepoch tries to move the global epoch on every advance_period calls per thread
+    static constexpr uint32_t advance_period = 64;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> localepoch{access};
+        uint32_t depth = 0;
+        uint32_t calls = 0;
+    };
+
+    friend class LockFreeThreadLocal<EpochManager, Slot>;
+
+    alignas(64) std::atomic<uint64_t> globaepoch;
+    LockFreeThreadLocal<EpochManager, Slot>* slots;
+
+private:
+
+    //called by the registry when a thread exits, its slot is handed to the next thread that registers
+    void thread_exit(Slot& slot) {
+        slot.depth = 0;
+        slot.localepoch.store(access, std::memory_order_release);
+    }
+
+public:
+
+    EpochManager(const EpochManager&) = delete;
+
+    EpochManager(const EpochManager&&) = delete;
+
+    EpochManager& operator = (const EpochManager&) = delete;
+
+    EpochManager& operator = (const EpochManager&&) = delete;
+
+    EpochManager() {
+        globaepoch.store(1);
+        slots = new LockFreeThreadLocal<EpochManager, Slot>(this);
+    }
+
+    ~EpochManager() {
+        delete slots;
+    }
+
+    //move the global epoch on if every thread inside a critical section has seen it
+    void advance() {
+        uint64_t epoch = globaepoch.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool behind = false;
+        slots->for_each([&](Slot& slot) {
+            uint64_t local = slot.localepoch.load(std::memory_order_acquire);
+            if (local != access && local != epoch) behind = true;
+        });
+        if (!behind) globaepoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    //the version to stamp a retired node with
+    uint64_t get_epoch() {
+        return globaepoch.load(std::memory_order_acquire);
+    }
+
+    //critical sections nest, only the outermost one publishes, returns the nesting depth
+    int lockepoch() {
+        Slot& slot = slots->get();
+        if (slot.depth++ == 0) {
+            slot.localepoch.store(globaepoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return slot.depth;
+    }
+
+    void unlockepoch(int index) {
+        Slot& slot = slots->get();
+        assert(slot.depth == uint32_t(index));
+        if (--slot.depth == 0) slot.localepoch.store(access, std::memory_order_release);
+    }
+
+    //nodes retired with a version below this can be reclaimed
+    uint64_t minepoch() {
+        Slot& slot = slots->get();
+        if (++slot.calls % advance_period == 0) advance();
+        return globaepoch.load(std::memory_order_acquire) - 1;
+    }
+
+};
\ No newline at end of file
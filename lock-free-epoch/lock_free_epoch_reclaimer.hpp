@@ -0,0 +1,261 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "lock_free_epoch.hpp"
+#include "../lock-free-memorypool/lock_free_memorypool.hpp"
+#include "../lock-free-common/lock_free_thread_local.hpp"
+
+//reclamation policy on top of EpochManager, see HazardPointerReclaimer for the other one
+//a policy gives the structure using it:
+//  Guard enter() / leave(Guard)            brackets every operation that dereferences shared nodes
+//  protect(Guard, int i, Node* node)       publishes node in hazard i, only needed when validates is true
+//  retire(Node* node)                      node was unlinked and goes back to the pool once nobody can reach it
+//  collect()                               called before an operation to hand reclaimable nodes back to the pool
+//  pending()                               nodes retired and not yet back in the pool
+//here a guard pins the current epoch, so protect is free and traversals need no validation,
+//but a reader stalled inside an epoch holds back every node retired after it
+//retired nodes go to a limbo batch private to the retiring thread, nothing shared is written per node,
+//a full batch is stamped with the epoch and freed as a whole with one deallocate_n once that epoch is old enough,
+//either by its own thread in collect or, in background mode, by a reclaimer thread that takes it off the hot path
+//a thread that exits seals its partial batch and hands all of its batches on, so thread churn does not strand memory
+template<typename Node>
+class EpochReclaimer {
+
+public:
+
+    using Guard = int;
+
+    static constexpr bool validates = false;
+
+private:
+
+    static constexpr uint32_t batch_size = 64;
+    static constexpr std::chrono::milliseconds background_interval{1};
+
+    struct Batch {
+        Node* nodes[batch_size];
+        uint32_t count;
+        //the epoch when the batch filled up, at least the one of every node in it
+        uint64_t version;
+        Batch* next;
+    };
+
+    struct alignas(64) Limbo {
+        Batch* current = nullptr;
+        //full batches, mostly oldest first, only used without the background thread
+        Batch* sealed_head = nullptr;
+        Batch* sealed_tail = nullptr;
+        Batch* spare = nullptr;
+        //written by the owning thread only, read by pending()
+        std::atomic<uint64_t> retired{0};
+        std::atomic<uint64_t> freed{0};
+    };
+
+    friend class LockFreeThreadLocal<EpochReclaimer, Limbo>;
+
+    LockFreeMemoryPool<Node>* pool;
+    EpochManager* epoch;
+    LockFreeThreadLocal<EpochReclaimer, Limbo>* limbos;
+
+    //background mode: full batches are pushed here and the reclaimer thread takes them all at once
+    //otherwise exited threads leave their batches here and the next collect of any thread adopts them
+    bool background;
+    alignas(64) std::atomic<Batch*> handoff;
+    std::atomic<uint64_t> background_freed;
+    std::atomic<bool> stop;
+    std::thread* reclaimer;
+
+private:
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    //the partial batch is sealed and every sealed batch goes to handoff, the pool is not touched here,
+    //its own thread state may already be gone
+    void thread_exit(Limbo& limbo) {
+        if (limbo.current) seal(limbo);
+        if (background || limbo.sealed_head == nullptr) return;
+        Batch* head = handoff.load(std::memory_order_relaxed);
+        do {
+            limbo.sealed_tail->next = head;
+        } while (!handoff.compare_exchange_weak(head, limbo.sealed_head, std::memory_order_release, std::memory_order_relaxed));
+        limbo.sealed_head = nullptr;
+        limbo.sealed_tail = nullptr;
+    }
+
+    //put the batches exited threads left in handoff in front of this thread's own, they are mostly older
+    void adopt(Limbo& limbo) {
+        Batch* orphans = handoff.exchange(nullptr, std::memory_order_acquire);
+        if (orphans == nullptr) return;
+        Batch* tail = orphans;
+        while (tail->next) tail = tail->next;
+        tail->next = limbo.sealed_head;
+        if (limbo.sealed_head == nullptr) limbo.sealed_tail = tail;
+        limbo.sealed_head = orphans;
+    }
+
+    Batch* new_batch(Limbo& limbo) {
+        Batch* batch = limbo.spare;
+        if (batch) limbo.spare = nullptr;
+        else batch = new Batch;
+        batch->count = 0;
+        batch->next = nullptr;
+        return batch;
+    }
+
+    void seal(Limbo& limbo) {
+        Batch* batch = limbo.current;
+        limbo.current = nullptr;
+        batch->version = epoch->get_epoch();
+        if (background) {
+            Batch* head = handoff.load(std::memory_order_relaxed);
+            do {
+                batch->next = head;
+            } while (!handoff.compare_exchange_weak(head, batch, std::memory_order_release, std::memory_order_relaxed));
+            return;
+        }
+        if (limbo.sealed_tail) limbo.sealed_tail->next = batch;
+        else limbo.sealed_head = batch;
+        limbo.sealed_tail = batch;
+    }
+
+    void reclaim_background() {
+        Batch* waiting = nullptr;
+        while (!stop.load(std::memory_order_acquire)) {
+            Batch* taken = handoff.exchange(nullptr, std::memory_order_acquire);
+            while (taken) {
+                Batch* next = taken->next;
+                taken->next = waiting;
+                waiting = taken;
+                taken = next;
+            }
+            epoch->advance();
+            uint64_t min_e = epoch->minepoch();
+            Batch** link = &waiting;
+            while (*link) {
+                Batch* batch = *link;
+                if (batch->version >= min_e) {
+                    link = &batch->next;
+                    continue;
+                }
+                *link = batch->next;
+                pool->deallocate_n(batch->nodes, batch->count);
+                add(background_freed, batch->count);
+                delete batch;
+            }
+            std::this_thread::sleep_for(background_interval);
+        }
+        //left for the destructor
+        while (waiting) {
+            Batch* next = waiting->next;
+            waiting->next = handoff.load(std::memory_order_relaxed);
+            handoff.store(waiting, std::memory_order_relaxed);
+            waiting = next;
+        }
+    }
+
+    void free_batches(Batch* batch) {
+        while (batch) {
+            Batch* next = batch->next;
+            pool->deallocate_n(batch->nodes, batch->count);
+            delete batch;
+            batch = next;
+        }
+    }
+
+public:
+
+    EpochReclaimer() = delete;
+
+    EpochReclaimer(const EpochReclaimer&) = delete;
+
+    EpochReclaimer(const EpochReclaimer&&) = delete;
+
+    EpochReclaimer& operator = (const EpochReclaimer&) = delete;
+
+    EpochReclaimer& operator = (const EpochReclaimer&&) = delete;
+
+    //the pool stays owned by the caller and must outlive the reclaimer
+    //_background starts a thread that frees full batches, collect then has nothing left to do
+    explicit EpochReclaimer(LockFreeMemoryPool<Node>* _pool, bool _background = false) {
+        pool = _pool;
+        epoch = new EpochManager;
+        limbos = new LockFreeThreadLocal<EpochReclaimer, Limbo>(this);
+        background = _background;
+        handoff.store(nullptr, std::memory_order_relaxed);
+        background_freed.store(0, std::memory_order_relaxed);
+        stop.store(false, std::memory_order_relaxed);
+        reclaimer = background ? new std::thread([this] { reclaim_background(); }) : nullptr;
+    }
+
+    //nodes still retired go back to the pool, nobody may be inside an operation any more
+    ~EpochReclaimer() {
+        if (reclaimer) {
+            stop.store(true, std::memory_order_release);
+            reclaimer->join();
+            delete reclaimer;
+        }
+        free_batches(handoff.load(std::memory_order_acquire));
+        limbos->for_each([&](Limbo& limbo) {
+            if (limbo.current) free_batches(limbo.current);
+            free_batches(limbo.sealed_head);
+            delete limbo.spare;
+        });
+        delete limbos;
+        delete epoch;
+    }
+
+    Guard enter() {
+        return epoch->lockepoch();
+    }
+
+    void leave(Guard guard) {
+        epoch->unlockepoch(guard);
+    }
+
+    void protect(Guard, int, Node*) {}
+
+    void retire(Node* node) {
+        Limbo& limbo = limbos->get();
+        if (limbo.current == nullptr) limbo.current = new_batch(limbo);
+        limbo.current->nodes[limbo.current->count++] = node;
+        add(limbo.retired, 1);
+        if (limbo.current->count == batch_size) seal(limbo);
+    }
+
+    //frees this thread's full batches whose epoch has passed, one deallocate_n each,
+    //along with those of exited threads, which the first thread to get here takes over
+    void collect() {
+        if (background) return;
+        Limbo& limbo = limbos->get();
+        if (handoff.load(std::memory_order_relaxed)) adopt(limbo);
+        if (limbo.sealed_head == nullptr) return;
+        uint64_t min_e = epoch->minepoch();
+        while (limbo.sealed_head && limbo.sealed_head->version < min_e) {
+            Batch* batch = limbo.sealed_head;
+            limbo.sealed_head = batch->next;
+            if (limbo.sealed_head == nullptr) limbo.sealed_tail = nullptr;
+            pool->deallocate_n(batch->nodes, batch->count);
+            add(limbo.freed, batch->count);
+            if (limbo.spare == nullptr) limbo.spare = batch;
+            else delete batch;
+        }
+    }
+
+    //retired nodes not yet back in the pool, a snapshot that may be off while threads retire
+    uint64_t pending() {
+        uint64_t retired = 0;
+        uint64_t freed = background_freed.load(std::memory_order_relaxed);
+        limbos->for_each([&](Limbo& limbo) {
+            retired += limbo.retired.load(std::memory_order_relaxed);
+            freed += limbo.freed.load(std::memory_order_relaxed);
+        });
+        return retired > freed ? retired - freed : 0;
+    }
+
+};
\ No newline at end of file
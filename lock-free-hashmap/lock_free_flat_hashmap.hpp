@@ -0,0 +1,327 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//fixed capacity open addressing table for small trivially copyable keys and values, an alternative to LockFreeHashMap
+//slots sit in groups with one control byte each: empty, deleted, or a 6 bit tag of the key's hash, either pending while
+//an insert is still writing the key or published, a group's tags are compared at once with SSE2 (16 wide) or AVX2 (32 wide)
+//an insert claims a slot, writes key and value into it, publishes the tag and then settles with the other published
+//claims of its key on the probe path: it yields to one that is already committed, kills the ones that are not and
+//commits its own, so a claim never waits for another one and a preempted claimer can not hold anybody up
+//remove and losing claims turn the slot into deleted, later inserts of any key reuse it, so capacity bounds the live keys,
+//but deleted slots never turn back into empty ones, after heavy churn misses probe further before they give up
+//every slot has two copies of its value, a writer fills the one readers are not using and then flips them,
+//so get takes no lock, writes nothing and never waits: it only retries when a write completed under it
+//writers and removers of the same key take turns on the slot's writing bit, nothing else waits
+template<typename K, typename V>
+class LockFreeFlatHashMap {
+
+    static_assert(std::is_trivially_copyable<K>::value, "flat table keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<V>::value, "flat table values must be trivially copyable");
+
+private:
+
+#if defined(__AVX2__)
+    static constexpr uint32_t group_width = 32;
+#elif defined(__SSE2__)
+    static constexpr uint32_t group_width = 16;
+#else
+    static constexpr uint32_t group_width = 8;
+#endif
+
+    static constexpr uint8_t empty = 0x80;
+    //a removed key or a claim that lost, free for the next claim but never empty again so probe chains stay intact
+    static constexpr uint8_t deleted = 0xfe;
+    //tag | pending marks a slot whose key is still being written
+    static constexpr uint8_t pending = 0x40;
+
+    //state: bit 0 is set while a writer or remover owns the slot, bit 1 while the key is live,
+    //bit 2 picks the value readers use, bit 3 once the claim won, bit 4 once it lost,
+    //the rest counts writes, removes and claims, so a reader or a stale CAS notices any of them
+    static constexpr uint32_t writing = 1;
+    static constexpr uint32_t live = 2;
+    static constexpr uint32_t current = 4;
+    static constexpr uint32_t committed = 8;
+    static constexpr uint32_t killed = 16;
+    static constexpr uint32_t version = 32;
+
+    struct Slot {
+        K key;
+        V values[2];
+        std::atomic<uint32_t> state;
+    };
+
+    //control bytes, kept as words so match can read a group with plain atomic loads
+    uint64_t* ctrl;
+    Slot* slots;
+    uint32_t group_mask;
+
+private:
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    static uint64_t hash(const K& key) {
+        uint64_t h = std::hash<K>()(key) * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 32);
+    }
+
+    static uint8_t tag(uint64_t h) {
+        return h >> 58;
+    }
+
+    uint8_t* control(uint32_t index) {
+        return reinterpret_cast<uint8_t*>(ctrl) + index;
+    }
+
+    static long long load_word(const uint64_t* word) {
+        return static_cast<long long>(__atomic_load_n(word, __ATOMIC_RELAXED));
+    }
+
+    //bit i is set when control byte i of the group equals byte
+    //the group is read as relaxed 8 byte atomic loads while claims CAS single bytes of it, such mixed size accesses are
+    //outside the C++ memory model, but GCC and Clang keep them single instructions and x86 and arm64 make every byte
+    //of the word come from one of its stores, so a byte is either seen before or after a CAS, never torn
+    uint32_t match(uint32_t group, uint8_t byte) {
+        const uint64_t* words = ctrl + group * (group_width / 8);
+#if defined(__AVX2__)
+        __m256i bytes = _mm256_set_epi64x(load_word(words + 3), load_word(words + 2), load_word(words + 1), load_word(words));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(char(byte))));
+#elif defined(__SSE2__)
+        __m128i bytes = _mm_set_epi64x(load_word(words + 1), load_word(words));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(char(byte))));
+#else
+        (void)words;
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < group_width; ++i) {
+            if (__atomic_load_n(control(group * group_width + i), __ATOMIC_RELAXED) == byte) mask |= 1u << i;
+        }
+#endif
+        //orders the key and state reads behind the relaxed loads
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return mask;
+    }
+
+    static bool settled(uint32_t state) {
+        return (state & (committed | live | killed)) == (committed | live);
+    }
+
+    //a slot whose committed claim held key and was live when looked at, nullptr once the probe reaches a group with an empty slot
+    //the key is compared without owning the slot, which may be reused meanwhile, lock rechecks it
+    Slot* find(const K& key, uint64_t h) {
+        uint32_t group = h & group_mask;
+        uint8_t t = tag(h);
+        for (uint32_t step = 1; step <= group_mask + 1; ++step) {
+            for (uint32_t mask = match(group, t); mask; mask &= mask - 1) {
+                Slot* slot = &slots[group * group_width + __builtin_ctz(mask)];
+                if (settled(slot->state.load(std::memory_order_acquire)) && slot->key == key) return slot;
+            }
+            if (match(group, empty)) return nullptr;
+            group = (group + step) & group_mask;
+        }
+        return nullptr;
+    }
+
+    //take the writing bit of a live slot that still holds key, false once it was removed or reused for another key
+    //returns the state from before, which stays put until unlocked: kills only hit uncommitted claims,
+    //removes take the bit themselves and reuse needs a slot that is not live
+    bool lock(Slot* slot, const K& key, uint32_t& state) {
+        state = slot->state.load(std::memory_order_relaxed);
+        while (true) {
+            if (!settled(state)) return false;
+            if (state & writing) {
+                cpu_relax();
+                state = slot->state.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (slot->state.compare_exchange_weak(state, state | writing, std::memory_order_acquire, std::memory_order_relaxed)) break;
+        }
+        if (slot->key == key) return true;
+        slot->state.store(state, std::memory_order_release);
+        return false;
+    }
+
+    //the spare copy is filled while readers keep using the current one, then the two are flipped
+    bool write_value(Slot* slot, const K& key, const V& value) {
+        uint32_t state;
+        if (!lock(slot, key, state)) return false;
+        memcpy(&slot->values[(state & current) ? 0 : 1], &value, sizeof(V));
+        slot->state.store((state ^ current) + version, std::memory_order_release);
+        return true;
+    }
+
+    //claim the first empty or deleted slot on the probe path as pending for tag t, -1 when there is none left
+    //the claim is never past the first group with an empty slot, so find still reaches it
+    int claim(uint64_t h, uint8_t t) {
+        uint32_t group = h & group_mask;
+        for (uint32_t step = 1; step <= group_mask + 1; ++step) {
+            for (uint32_t mask = match(group, empty) | match(group, deleted); mask; mask &= mask - 1) {
+                uint32_t index = group * group_width + __builtin_ctz(mask);
+                uint8_t expected = __atomic_load_n(control(index), __ATOMIC_RELAXED);
+                if (expected != empty && expected != deleted) continue;
+                if (__atomic_compare_exchange_n(control(index), &expected, uint8_t(t | pending), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return index;
+            }
+            group = (group + step) & group_mask;
+        }
+        return -1;
+    }
+
+    //mark a claim or a removed key as deleted, only after its state says so, that is what lets claim reuse the slot
+    void release(Slot* slot) {
+        __atomic_store_n(control(slot - slots), deleted, __ATOMIC_RELEASE);
+    }
+
+    //settle mine, published with state, against every other published claim of key on the probe path:
+    //a committed live one wins and mine is killed, the uncommitted ones are killed and then mine commits
+    //of two claims at least one sees the other published, and kill and commit are CASes on the loser's state,
+    //so at most one claim of a key ever commits while it is live
+    //returns mine, the winner to write into, or nullptr once a rival killed mine and the insert has to start over
+    Slot* settle(const K& key, uint64_t h, Slot* mine, uint32_t state) {
+        uint32_t group = h & group_mask;
+        uint8_t t = tag(h);
+        for (uint32_t step = 1; step <= group_mask + 1; ++step) {
+            for (uint32_t mask = match(group, t); mask; mask &= mask - 1) {
+                Slot* slot = &slots[group * group_width + __builtin_ctz(mask)];
+                if (slot == mine) continue;
+                uint32_t other = slot->state.load(std::memory_order_acquire);
+                while (!(other & killed) && (other & live) && slot->key == key) {
+                    if (other & committed) {
+                        //a stale view of a reused slot only costs a restart, write_value checks the key again
+                        if (mine->state.compare_exchange_strong(state, state | killed, std::memory_order_acq_rel)) {
+                            release(mine);
+                            return slot;
+                        }
+                        return nullptr;
+                    }
+                    if (slot->state.compare_exchange_strong(other, other | killed, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                        release(slot);
+                        break;
+                    }
+                }
+            }
+            if (match(group, empty)) break;
+            group = (group + step) & group_mask;
+        }
+        if (mine->state.compare_exchange_strong(state, state | committed, std::memory_order_acq_rel)) return mine;
+        return nullptr;
+    }
+
+public:
+
+    LockFreeFlatHashMap() = delete;
+
+    LockFreeFlatHashMap(const LockFreeFlatHashMap&) = delete;
+
+    LockFreeFlatHashMap(const LockFreeFlatHashMap&&) = delete;
+
+    LockFreeFlatHashMap& operator = (const LockFreeFlatHashMap&) = delete;
+
+    LockFreeFlatHashMap& operator = (const LockFreeFlatHashMap&&) = delete;
+
+    //_size is the number of keys live at once, the table keeps 1/8 of its slots spare to stay short on probes
+    explicit LockFreeFlatHashMap(uint32_t _size) {
+        assert(_size > 0 && _size <= 0x70000000u);
+        uint64_t groups = (uint64_t(_size) * 8 / 7 + group_width - 1) / group_width;
+        groups = groups <= 1 ? 1 : 1ull << (64 - __builtin_clzll(groups - 1));
+        group_mask = groups - 1;
+        uint64_t capacity = groups * group_width;
+        ctrl = new (std::align_val_t(64), std::nothrow) uint64_t[capacity / 8];
+        slots = new (std::nothrow) Slot[capacity];
+        if (!ctrl || !slots) {
+            std::cerr << "Memory allocation failed for lock free flat hashmap\n";
+            exit(0);
+        }
+        memset(ctrl, empty, capacity);
+        for (uint64_t i = 0; i < capacity; ++i) {
+            slots[i].state.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~LockFreeFlatHashMap() {
+        ::operator delete[](ctrl, std::align_val_t(64));
+        delete[] slots;
+    }
+
+    //false when the key is missing and every slot of the table holds a live key or a claim in progress
+    bool insert(const K& key, const V& value) {
+        uint64_t h = hash(key);
+        uint8_t t = tag(h);
+        while (true) {
+            Slot* slot = find(key, h);
+            if (slot) {
+                if (write_value(slot, key, value)) return true;
+                continue;
+            }
+            int index = claim(h, t);
+            if (index < 0) return false;
+            Slot* mine = &slots[index];
+            memcpy(&mine->key, &key, sizeof(K));
+            memcpy(&mine->values[0], &value, sizeof(V));
+            //a fresh version, so readers and CASes that still hold the slot's previous key fail
+            uint32_t state = ((mine->state.load(std::memory_order_relaxed) & ~(version - 1)) + version) | live;
+            mine->state.store(state, std::memory_order_relaxed);
+            __atomic_store_n(control(index), t, __ATOMIC_RELEASE);
+            //pairs with the same fence in every other claim of key: of two claims at least one sees the other published
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            Slot* winner = settle(key, h, mine, state);
+            if (winner == mine) return true;
+            if (winner && write_value(winner, key, value)) return true;
+        }
+    }
+
+    //a missing key reads as V()
+    //a writer in progress only touches the spare copy, so the writing bit is ignored, the copy read is only torn
+    //when a later write flipped the copies back onto it, and then the version has moved on,
+    //the key is compared inside the same window, a slot reused for another key meanwhile fails it as well
+    V get(const K& key) {
+        uint64_t h = hash(key);
+        uint32_t group = h & group_mask;
+        uint8_t t = tag(h);
+        V value;
+        for (uint32_t step = 1; step <= group_mask + 1; ++step) {
+            for (uint32_t mask = match(group, t); mask; mask &= mask - 1) {
+                Slot* slot = &slots[group * group_width + __builtin_ctz(mask)];
+                while (true) {
+                    uint32_t before = slot->state.load(std::memory_order_acquire);
+                    if (!settled(before)) break;
+                    bool same = slot->key == key;
+                    memcpy(&value, &slot->values[(before & current) ? 1 : 0], sizeof(V));
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (((slot->state.load(std::memory_order_relaxed) ^ before) & ~writing) != 0) continue;
+                    if (same) return value;
+                    break;
+                }
+            }
+            if (match(group, empty)) break;
+            group = (group + step) & group_mask;
+        }
+        return V();
+    }
+
+    void remove(const K& key) {
+        uint64_t h = hash(key);
+        while (true) {
+            Slot* slot = find(key, h);
+            if (slot == nullptr) return;
+            uint32_t state;
+            if (!lock(slot, key, state)) continue;
+            slot->state.store((state & ~live) + version, std::memory_order_release);
+            release(slot);
+            return;
+        }
+    }
+
+};
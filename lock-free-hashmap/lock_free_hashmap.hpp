@@ -1,36 +1,95 @@
+#pragma once
+
 #include <iostream>
 #include <cassert>
 #include <atomic>
+#include <optional>
+#include <type_traits>
 
 #include "lock_free_linklist.hpp"
 
-template<typename K, typename V>
+//split ordered hash table (Shalev & Shavit): every node lives in one LockFreeSplitList ordered by bit reversed hash
+//and a bucket is a pointer to a sentinel node in that list, so doubling the bucket count moves no nodes,
+//the new buckets get their sentinels lazily on first use by splitting their parent bucket
+//Reclaimer picks how removed nodes are reclaimed: EpochReclaimer (default) or HazardPointerReclaimer,
+//the latter keeps memory bounded when a thread stalls in the middle of an operation
+template<typename K, typename V, template<typename> class Reclaimer = EpochReclaimer>
 class LockFreeHashMap {
 
 private:
-    struct Node {
-        K key;
-        V value;
-        std::atomic<bool> changing;
-        std::atomic<Node*> next;
-
-    };
-
-    struct DeleteNode {
-        Node* node;
-        uint64_t version;
-    };
-
-    uint32_t size;
-    uint32_t capacity;
-    LockFreeLinklist<K, V>* linkset;
-    LockFreeStack<DeleteNode>* remove_set;
+    using List = LockFreeSplitList<K, V, Reclaimer>;
+    using Node = typename List::Node;
+
+    //level 0 holds the first base_buckets buckets, level l > 0 holds buckets [base_buckets << (l - 1), base_buckets << l)
+    static constexpr int max_levels = 32;
+    //average nodes per bucket before the bucket count doubles
+    static constexpr uint64_t max_load = 2;
+
+    uint64_t base_buckets;
+    uint32_t base_shift;
+    std::atomic<std::atomic<Node*>*> levels[max_levels];
+
+    std::atomic<uint64_t> bucket_count;
+    std::atomic<uint64_t> element_count;
+
+    List* list;
     LockFreeMemoryPool<Node>* pool;
-    EpochManager* epoch;
+    Reclaimer<Node>* reclaimer;
 
 private:
-    int hash(const K& key) const {
-        return std::hash<K>()(key) % size;
+    static uint64_t reverse(uint64_t v) {
+        v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+        v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+        v = ((v >> 4) & 0x0f0f0f0f0f0f0f0full) | ((v & 0x0f0f0f0f0f0f0f0full) << 4);
+        return __builtin_bswap64(v);
+    }
+
+    uint64_t hash(const K& key) const {
+        return std::hash<K>()(key);
+    }
+
+    //the top bit is set before reversing so regular keys are odd and sort after their bucket's sentinel
+    static uint64_t regular_key(uint64_t h) {
+        return reverse(h | (1ull << 63));
+    }
+
+    static uint64_t sentinel_key(uint64_t bucket) {
+        return reverse(bucket);
+    }
+
+    std::atomic<Node*>& bucket_slot(uint64_t bucket) {
+        int l = bucket < base_buckets ? 0 : 64 - __builtin_clzll(bucket >> base_shift);
+        uint64_t begin = l == 0 ? 0 : base_buckets << (l - 1);
+        std::atomic<Node*>* level = levels[l].load(std::memory_order_acquire);
+        if (level == nullptr) {
+            uint64_t n = l == 0 ? base_buckets : base_buckets << (l - 1);
+            std::atomic<Node*>* fresh = new std::atomic<Node*>[n]();
+            if (levels[l].compare_exchange_strong(level, fresh, std::memory_order_acq_rel)) level = fresh;
+            else delete[] fresh;
+        }
+        return level[bucket - begin];
+    }
+
+    //sentinel of bucket, created after its parent's sentinel (bucket without its top bit) if needed
+    Node* get_bucket(uint64_t bucket) {
+        std::atomic<Node*>& slot = bucket_slot(bucket);
+        Node* sentinel = slot.load(std::memory_order_acquire);
+        if (sentinel) return sentinel;
+        uint64_t parent = bucket & ~(1ull << (63 - __builtin_clzll(bucket)));
+        sentinel = list->insert_sentinel(get_bucket(parent), sentinel_key(bucket));
+        slot.store(sentinel, std::memory_order_release);
+        return sentinel;
+    }
+
+    Node* bucket_of(uint64_t h) {
+        return get_bucket(h & (bucket_count.load(std::memory_order_acquire) - 1));
+    }
+
+    void grow_if_loaded(uint64_t elements) {
+        uint64_t buckets = bucket_count.load(std::memory_order_relaxed);
+        if (elements > buckets * max_load && buckets < (base_buckets << (max_levels - 1))) {
+            bucket_count.compare_exchange_strong(buckets, buckets * 2, std::memory_order_acq_rel);
+        }
     }
 
 public:
@@ -45,38 +104,110 @@ public:
 
     LockFreeHashMap& operator = (const LockFreeHashMap&&) = delete;
 
-    explicit LockFreeHashMap(uint32_t _size) {
-        size = _size;
-        capacity = _size * 3;
-        remove_set = new LockFreeStack<DeleteNode>(capacity);
-        pool = new LockFreeMemoryPool<Node>(capacity);
-        epoch = new EpochManager;
-        linkset = new LockFreeLinklist<K, V>[size](pool, remove_set, epoch);
+    //_size is the initial bucket count rounded up to pow of 2, the table doubles whenever it averages max_load nodes per bucket
+    //magazine_size > 0 gives every thread its own node cache, see LockFreeMemoryPool
+    //background_reclaim hands removed nodes to a reclaimer thread instead of freeing them inside operations
+    explicit LockFreeHashMap(uint32_t _size, uint32_t magazine_size = 0, bool background_reclaim = false) {
+        assert(_size > 0 && _size <= 0x80000000u);
+        base_buckets = _size == 1 ? 1 : 1ull << (64 - __builtin_clzll(uint64_t(_size) - 1));
+        base_shift = __builtin_ctzll(base_buckets);
+        for (int l = 0; l < max_levels; ++l) {
+            levels[l].store(nullptr, std::memory_order_relaxed);
+        }
+        bucket_count.store(base_buckets, std::memory_order_relaxed);
+        element_count.store(0, std::memory_order_relaxed);
+        uint32_t nodes = base_buckets * 3 < 0x80000000ull ? uint32_t(base_buckets * 3) : 0x80000000u;
+        pool = new LockFreeMemoryPool<Node>(nodes, magazine_size);
+        reclaimer = new Reclaimer<Node>(pool, background_reclaim);
+        list = new List(pool, reclaimer);
+        bucket_slot(0).store(list->head_node(), std::memory_order_release);
     }
 
+    //the list and the reclaimer hand their nodes back to the pool, so they go first
     ~LockFreeHashMap() {
-        delete remove_set;
+        delete list;
+        for (int l = 0; l < max_levels; ++l) {
+            delete[] levels[l].load(std::memory_order_acquire);
+        }
+        delete reclaimer;
         delete pool;
-        delete epoch;
-        delete linkset;
     }
 
     void insert(const K& key, const V& value) {
-        int index = hash(key);
-        LockFreeLinklist<K, V>* link = &linkset[index];
-        link->insert(key, value);
+        upsert(key, value);
+    }
+
+    //insert or overwrite, the write is never dropped, true when the key was new
+    bool upsert(const K& key, const V& value) {
+        uint64_t h = hash(key);
+        bool inserted = list->insert(bucket_of(h), regular_key(h), key, value);
+        if (inserted) grow_if_loaded(element_count.fetch_add(1, std::memory_order_relaxed) + 1);
+        return inserted;
+    }
+
+    std::optional<V> find(const K& key) {
+        uint64_t h = hash(key);
+        return list->find(bucket_of(h), regular_key(h), key);
     }
 
+    //a missing key reads as V(), use find to tell the two apart
     V get(const K& key) {
-        int index = hash(key);
-        LockFreeLinklist<K, V>* link = &linkset[index];
-        return link->search(key);
+        std::optional<V> value = find(key);
+        return value ? *value : V();
+    }
+
+    //run fn(const V&) on the value, false when the key is missing, see LockFreeSplitList::visit
+    template<typename Fn>
+    bool visit(const K& key, Fn&& fn) {
+        uint64_t h = hash(key);
+        return list->visit(bucket_of(h), regular_key(h), key, fn);
+    }
+
+    //apply fn(V&) to the key's value, inserting V() first if it is missing, true when it was
+    //a throwing fn leaves the value as it was, a key it was inserted for stays in with V()
+    template<typename Fn>
+    bool compute(const K& key, Fn&& fn) {
+        uint64_t h = hash(key);
+        bool inserted = false;
+        try {
+            list->compute(bucket_of(h), regular_key(h), key, fn, inserted);
+        }
+        catch (...) {
+            if (inserted) grow_if_loaded(element_count.fetch_add(1, std::memory_order_relaxed) + 1);
+            throw;
+        }
+        if (inserted) grow_if_loaded(element_count.fetch_add(1, std::memory_order_relaxed) + 1);
+        return inserted;
+    }
+
+    //counter fast path for integral values: one atomic add on the stored value, returns the value before it
+    template<typename U = V>
+    typename std::enable_if<std::is_integral<U>::value, V>::type fetch_add(const K& key, V delta) {
+        uint64_t h = hash(key);
+        bool inserted;
+        V old = list->fetch_add(bucket_of(h), regular_key(h), key, delta, inserted);
+        if (inserted) grow_if_loaded(element_count.fetch_add(1, std::memory_order_relaxed) + 1);
+        return old;
     }
 
     void remove(const K& key) {
-        int index = hash(key);
-        LockFreeLinklist<K, V>* link = &linkset[index];
-        link->remove(key);
+        uint64_t h = hash(key);
+        if (list->remove(bucket_of(h), regular_key(h), key)) {
+            element_count.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t size() const {
+        return element_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t buckets() const {
+        return bucket_count.load(std::memory_order_relaxed);
+    }
+
+    //removed nodes still waiting to go back to the pool
+    uint64_t pending_reclaim() {
+        return reclaimer->pending();
     }
 
 };
\ No newline at end of file
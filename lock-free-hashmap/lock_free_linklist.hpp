@@ -1,238 +1,353 @@
+#pragma once
+
 #include <iostream>
 #include <atomic>
 #include <cassert>
+#include <optional>
+#include <type_traits>
 
-#include "../lock-free-stack/lock_free_stack.hpp"
-
-class EpochManager {
-
-private:
-
-    static constexpr int max_threads = 128;
-    static constexpr uint64_t access = -1ull;
-    std::atomic<uint64_t> globaepoch;
-    std::atomic<uint64_t> localepoch[max_threads];
+#include "../lock-free-epoch/lock_free_epoch_reclaimer.hpp"
+#include "../lock-free-hazard-pointer/lock_free_hazard_pointer.hpp"
+#include "../lock-free-common/lock_free_value_cell.hpp"
 
+//one list ordered by split order key (Shalev & Shavit) and then by key, the hashmap's bucket sentinels are nodes of it
+//the split order key is the bit reversed hash, so every node caches its hash and most mismatches never touch the key
+//every operation starts at a sentinel, so a bucket is a window into the shared list instead of a list of its own
+//a node is deleted by marking bit 0 of its next and then unlinked by whoever passes it (Michael)
+//Reclaimer decides when an unlinked node goes back to the pool, EpochReclaimer or HazardPointerReclaimer
+template<typename K, typename V, template<typename> class Reclaimer = EpochReclaimer>
+class LockFreeSplitList {
 
 public:
 
-    EpochManager() {
-        globaepoch.store(0);
-        for (int i = 0; i < max_threads; ++i) {
-            localepoch[i].store(access);
-        }
-    }
-
-    uint64_t get_epoch() {
-        return globaepoch.fetch_add(1, std::memory_order_acq_rel);
-    }
-
-    int lockepoch() {
-        uint64_t epoch = get_epoch();
-        uint64_t is_access = access;
-        for (int i = 0; i < max_threads; ++i) {
-            if (localepoch[i].compare_exchange_strong(is_access, epoch, std::memory_order_acquire)) {
-                return i;
-            }
-        }
-        std::cerr << "threads is too much\n";
-        exit(0);
-        return -1;
-    }
-
-    void unlockepoch(int index) {
-        localepoch[index].store(access, std::memory_order_release);
-    }
+    //public so the owner can size the shared pool and build the reclaimer
+    struct alignas(8) Node {
+        //sentinels have an even so_key, regular nodes an odd one
+        uint64_t so_key;
+        K key;
+        LockFreeValueCell<V> value;
+        std::atomic<Node*> next;
 
-    uint64_t minepoch() {
-        uint64_t min_e = access; 
-        for (int i = 0; i < max_threads; ++i) {
-            uint64_t epoch = localepoch[i].load(std::memory_order_acquire);
-            if (min_e > epoch) {
-                min_e = epoch;
-            }
-        }
-        return min_e;
-    }
+    };
 
-};
+private:
 
-template<typename K, typename V>
-class LockFreeLinklist {
+    using Guard = typename Reclaimer<Node>::Guard;
 
-private:
+    static constexpr bool validates = Reclaimer<Node>::validates;
+    //hazards find keeps on the nodes it walks, cur stays protected until the operation leaves
+    //node holds an insert's fresh node, so cur keeps its hazard while the linking CAS compares against it
+    static constexpr int hazard_next = 0;
+    static constexpr int hazard_cur = 1;
+    static constexpr int hazard_prev = 2;
+    static constexpr int hazard_node = 3;
 
-    struct alignas(8) Node {
-        K key;
-        V value;
-        std::atomic<bool> changing;
-        std::atomic<Node*> next;
+    template<typename T, typename = void>
+    struct has_less : std::false_type {};
 
-    };
+    template<typename T>
+    struct has_less<T, std::void_t<decltype(std::declval<const T&>() < std::declval<const T&>())>> : std::true_type {};
 
-    struct DeleteNode {
-        Node* node;
-        uint64_t version;
-    };
+    static constexpr bool ordered_keys = has_less<K>::value;
 
-    //These resources come from outside, they need to be released manually by the upper application 
-    LockFreeStack<DeleteNode>* remove_set;
+    //These resources come from outside, they need to be released manually by the upper application
     LockFreeMemoryPool<Node>* pool;
-    EpochManager* epoch;
+    Reclaimer<Node>* reclaimer;
 
+    //sentinel of bucket 0
     Node head;
 
 private :
 
-    bool is_remove(Node* node) {
-        return reinterpret_cast<uint64_t>(node->next.load(std::memory_order_acquire)) & 1;
+    static bool is_remove(Node* next) {
+        return reinterpret_cast<uint64_t>(next) & 1;
     }
 
-    Node* get_next(Node* node) {
-        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(node->next.load(std::memory_order_acquire)) & ~uint64_t(1));
+    static Node* unmark(Node* next) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) & ~uint64_t(1));
     }
 
-    Node* get_remove_next(Node* node) {
-        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(node->next.load(std::memory_order_acquire)) & ~uint64_t(2));
+    static Node* mark(Node* next) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) | 1);
     }
 
-    void try_remove_from_link(Node* prev, Node* node) {
-        if (!is_remove(node)) return;
-        Node* next = get_next(node);
-        Node* remo_next = get_remove_next(node);
-        Node* mark_next = reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) | 2);
-        if (!node->next.compare_exchange_strong(remo_next, mark_next, std::memory_order_acq_rel)) {
-            return;
-        }
-        if (!prev->next.compare_exchange_strong(node, next, std::memory_order_acq_rel)) {
-            node->next.store(remo_next, std::memory_order_release);
-            return;
+    static bool is_sentinel(uint64_t so_key) {
+        return (so_key & 1) == 0;
+    }
+
+    //position prev/cur so that prev->next was cur and cur is the first node not ordered before (so_key, key)
+    //marked nodes met on the way are unlinked and retired, true when cur matches
+    //under a validating reclaimer a node is only read once it is protected and prev still links to it
+    bool find(Guard guard, Node* start, uint64_t so_key, const K* key, Node*& prev, Node*& cur) {
+        while (true) {
+            prev = start;
+            cur = unmark(prev->next.load(std::memory_order_acquire));
+            if constexpr (validates) {
+                reclaimer->protect(guard, hazard_cur, cur);
+                if (prev->next.load(std::memory_order_acquire) != cur) continue;
+            }
+            bool restart = false;
+            while (cur) {
+                Node* next = cur->next.load(std::memory_order_acquire);
+                if constexpr (validates) {
+                    reclaimer->protect(guard, hazard_next, unmark(next));
+                    if (cur->next.load(std::memory_order_acquire) != next || prev->next.load(std::memory_order_acquire) != cur) {
+                        restart = true;
+                        break;
+                    }
+                }
+                if (is_remove(next)) {
+                    Node* expected = cur;
+                    if (!prev->next.compare_exchange_strong(expected, unmark(next), std::memory_order_acq_rel)) {
+                        restart = true;
+                        break;
+                    }
+                    reclaimer->retire(cur);
+                    cur = unmark(next);
+                    if constexpr (validates) reclaimer->protect(guard, hazard_cur, cur);
+                    continue;
+                }
+                if (cur->so_key > so_key) return false;
+                //keys are only compared once the cached hash matches, ties are kept in key order when K has a <
+                if (cur->so_key == so_key) {
+                    if (is_sentinel(so_key) || cur->key == *key) return true;
+                    if constexpr (ordered_keys) {
+                        if (*key < cur->key) return false;
+                    }
+                }
+                prev = cur;
+                if constexpr (validates) {
+                    reclaimer->protect(guard, hazard_prev, cur);
+                    reclaimer->protect(guard, hazard_cur, next);
+                }
+                cur = next;
+            }
+            if (!restart) return false;
         }
-        DeleteNode deletenode = {node, epoch->get_epoch()};
-        remove_set->push(deletenode);
     }
 
-    void try_remove_to_pool() {
-        DeleteNode deletenode;
-        while (remove_set.pop(deletenode)) {
-            if (deletenode->version > epoch->minepoch()) {
-                remove_set.push(deletenode);
-                break;
+    //the node holding key, linking a fresh one prepared by init when key is missing, inserted tells which
+    //must run between enter and leave
+    template<typename Init>
+    Node* find_or_insert(Guard guard, Node* start, uint64_t so_key, const K& key, Init&& init, bool& inserted) {
+        Node* node = nullptr;
+        Node* prev;
+        Node* cur;
+        inserted = false;
+        while (true) {
+            if (find(guard, start, so_key, &key, prev, cur)) break;
+            if (node == nullptr) {
+                node = new_node(so_key);
+                try {
+                    node->key = key;
+                    init(node);
+                }
+                catch (...) {
+                    pool->deallocate(node);
+                    throw;
+                }
             }
-            else pool->deallocate(deletenode.node);
+            //protected before it is linked, a remover may retire it as soon as it is
+            if constexpr (validates) reclaimer->protect(guard, hazard_node, node);
+            node->next.store(cur, std::memory_order_relaxed);
+            if (prev->next.compare_exchange_strong(cur, node, std::memory_order_acq_rel)) {
+                inserted = true;
+                return node;
+            }
+        }
+        if (node) pool->deallocate(node);
+        return cur;
+    }
+
+    Node* new_node(uint64_t so_key) {
+        Node* node = pool->allocate();
+        if (node == nullptr) {
+            std::cerr << "Pool size is too small\n";
+            exit(0);
         }
+        node->so_key = so_key;
+        return node;
     }
 
 public:
 
-    LockFreeLinklist() = delete;
+    LockFreeSplitList() = delete;
 
-    LockFreeLinklist(const LockFreeLinklist&) = delete;
+    LockFreeSplitList(const LockFreeSplitList&) = delete;
 
-    LockFreeLinklist(const LockFreeLinklist&&) = delete;
+    LockFreeSplitList(const LockFreeSplitList&&) = delete;
 
-    LockFreeLinklist& operator = (const LockFreeLinklist&) = delete;
+    LockFreeSplitList& operator = (const LockFreeSplitList&) = delete;
 
-    LockFreeLinklist& operator = (const LockFreeLinklist&&) = delete;
+    LockFreeSplitList& operator = (const LockFreeSplitList&&) = delete;
 
-    explicit LockFreeLinklist(LockFreeMemoryPool<Node>* _pool, LockFreeStack<DeleteNode>* _remove_set, EpochManager* _epoch) {
+    explicit LockFreeSplitList(LockFreeMemoryPool<Node>* _pool, Reclaimer<Node>* _reclaimer) {
+        head.so_key = 0;
         head.next = nullptr;
         pool = _pool;
-        remove_set = _remove_set;
-        epoch = _epoch;
+        reclaimer = _reclaimer;
     }
 
-    ~LockFreeLinklist() {
-        Node* node = head.next.load(std::memory_order_acquire);
-        DeleteNode deletenode;
-        while (remove_set->pop(deletenode)) {
-            pool->deallocate(deletenode.node);
-        }
+    //only the linked nodes are freed here, retired ones belong to the reclaimer
+    ~LockFreeSplitList() {
+        Node* node = unmark(head.next.load(std::memory_order_acquire));
         while (node) {
+            Node* next = unmark(node->next.load(std::memory_order_acquire));
             pool->deallocate(node);
-            node = get_next(node);
+            node = next;
         }
     }
 
-    void insert(const K& key, const V& value) {
-        try_remove_to_pool();
-        int index = epoch->lockepoch();
+    Node* head_node() {
+        return &head;
+    }
 
-        Node* new_node = pool->allocate();
-        if (new_node == nullptr) {
-            std::cerr << "Pool size is too small\n";
-            exit(0);
-        }
-        new_node->key = key;
-        new_node->value = value;
-        new_node->next.store(nullptr, std::memory_order_release);
+    //returns the sentinel with so_key, linking a new one after start if there is none yet
+    //sentinels are never removed, so the returned node stays valid for the list's lifetime
+    Node* insert_sentinel(Node* start, uint64_t so_key) {
+        assert(is_sentinel(so_key));
+        Guard guard = reclaimer->enter();
+
+        Node* sentinel = nullptr;
+        Node* prev;
+        Node* cur;
         while (true) {
-            Node* prev = &head;
-            Node* node = prev->next.load(std::memory_order_acquire);
-            while (node) {
-                try_remove_from_link(prev, node);
-                if (!is_remove(node) && node->key == key) {
-                    break;
-                }
-                prev = node;
-                node = get_next(node);
-            }
-            if (node != nullptr) {
-                bool is_not_changing = false;
-                if (node->changing.compare_exchange_strong(is_not_changing, true, std::memory_order_acq_rel)) {
-                    node->value = value;
-                    node->changing.store(is_not_changing, std::memory_order_release);
-                }
-                pool->deallocate(new_node);
-                break;
-            }
-            if(prev->next.compare_exchange_strong(node, new_node, std::memory_order_acq_rel)) {
+            if (find(guard, start, so_key, nullptr, prev, cur)) break;
+            if (sentinel == nullptr) sentinel = new_node(so_key);
+            sentinel->next.store(cur, std::memory_order_relaxed);
+            if (prev->next.compare_exchange_strong(cur, sentinel, std::memory_order_acq_rel)) {
+                cur = sentinel;
+                sentinel = nullptr;
                 break;
             }
         }
+        if (sentinel) pool->deallocate(sentinel);
 
-        epoch->unlockepoch(index);
+        reclaimer->leave(guard);
+        return cur;
     }
 
-    V search(const K& key) {
-        try_remove_to_pool();
-        int index = epoch->lockepoch();
+    //true when the key was new, an existing key gets its value replaced
+    bool insert(Node* start, uint64_t so_key, const K& key, const V& value) {
+        reclaimer->collect();
+        Guard guard = reclaimer->enter();
 
-        Node* prev = &head;
-        Node* node = head.next.load(std::memory_order_acquire);
-        while (node) {
-            try_remove_from_link(prev, node);
-            if (!is_remove(node) && node->key == key) break;
-            prev = node;
-            node = get_next(node);
-        }
-        V value;
-        if (node != nullptr) value = node->value;
-        epoch->unlockepoch(index);
+        bool inserted;
+        Node* node = find_or_insert(guard, start, so_key, key, [&](Node* fresh) {
+            fresh->value.init(value);
+        }, inserted);
+        if (!inserted) node->value.store(value);
+
+        reclaimer->leave(guard);
+        return inserted;
+    }
+
+    //a copy of the value, see LockFreeValueCell for how it is read
+    std::optional<V> find(Node* start, uint64_t so_key, const K& key) {
+        reclaimer->collect();
+        Guard guard = reclaimer->enter();
+
+        Node* prev;
+        Node* cur;
+        std::optional<V> value;
+        V copy;
+        if (find(guard, start, so_key, &key, prev, cur) && cur->value.load(copy)) value = copy;
+
+        reclaimer->leave(guard);
         return value;
     }
 
-    void remove(const K& key) {
-        try_remove_to_pool();
-        int index = epoch->lockepoch();
+    //fn(const V&) runs on a snapshot of the value, or on the value itself when V is not trivially copyable,
+    //which then holds off writers of the key until fn returns, so fn must not touch the same key
+    template<typename Fn>
+    bool visit(Node* start, uint64_t so_key, const K& key, Fn&& fn) {
+        reclaimer->collect();
+        Guard guard = reclaimer->enter();
+
+        Node* prev;
+        Node* cur;
+        bool found = false;
+        try {
+            found = find(guard, start, so_key, &key, prev, cur) && cur->value.visit(fn);
+        }
+        catch (...) {
+            reclaimer->leave(guard);
+            throw;
+        }
 
-        Node* prev = &head;
-        Node* node = prev->next.load(std::memory_order_acquire);
-        while (node) {
-            try_remove_from_link(prev, node);
-            if (!is_remove(node) && node->key == key) break;
-            prev = node;
-            node = get_next(node);
+        reclaimer->leave(guard);
+        return found;
+    }
+
+    //fn(V&) is applied exactly once to the key's value, a missing key is inserted as V() first, inserted tells whether it was
+    //word sized values (see LockFreeValueCell) are updated by CAS, there fn may run more than once and must only depend on its argument
+    //if fn throws the exception reaches the caller, the value stays as it was and a key this call inserted holds V()
+    template<typename Fn>
+    void compute(Node* start, uint64_t so_key, const K& key, Fn&& fn, bool& inserted) {
+        reclaimer->collect();
+        Guard guard = reclaimer->enter();
+
+        inserted = false;
+        try {
+            //a fresh value that is not word sized is linked before fn runs on it and can not be read until fn is done
+            Node* node = find_or_insert(guard, start, so_key, key, [&](Node* fresh) {
+                fresh->value.prepare(fn);
+            }, inserted);
+            if (inserted) node->value.complete(fn);
+            else node->value.apply(fn);
+        }
+        catch (...) {
+            reclaimer->leave(guard);
+            throw;
         }
 
-        if (node != nullptr) {
-            Node* next = get_next(node);
-            Node* mark_next = reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) | 1);
-            node->next.compare_exchange_strong(next, mark_next, std::memory_order_acq_rel);
-            try_remove_from_link(prev, node);
+        reclaimer->leave(guard);
+    }
+
+    //add delta to an integral value in place, a missing key starts at 0, returns the value before the add
+    template<typename U = V>
+    typename std::enable_if<std::is_integral<U>::value, V>::type fetch_add(Node* start, uint64_t so_key, const K& key, V delta, bool& inserted) {
+        reclaimer->collect();
+        Guard guard = reclaimer->enter();
+
+        Node* node = find_or_insert(guard, start, so_key, key, [&](Node* fresh) {
+            fresh->value.init(delta);
+        }, inserted);
+        V old = inserted ? V() : node->value.fetch_add(delta);
+
+        reclaimer->leave(guard);
+        return old;
+    }
+
+    //true when this call removed the key
+    bool remove(Node* start, uint64_t so_key, const K& key) {
+        reclaimer->collect();
+        Guard guard = reclaimer->enter();
+
+        bool removed = false;
+        Node* prev;
+        Node* cur;
+        if (find(guard, start, so_key, &key, prev, cur)) {
+            Node* next = cur->next.load(std::memory_order_acquire);
+            while (!is_remove(next)) {
+                if (cur->next.compare_exchange_weak(next, mark(next), std::memory_order_acq_rel)) {
+                    removed = true;
+                    break;
+                }
+            }
+            if (removed) {
+                Node* expected = cur;
+                if (prev->next.compare_exchange_strong(expected, unmark(next), std::memory_order_acq_rel)) {
+                    reclaimer->retire(cur);
+                }
+                else {
+                    find(guard, start, so_key, &key, prev, cur);
+                }
+            }
         }
 
-        epoch->unlockepoch(index);
+        reclaimer->leave(guard);
+        return removed;
     }
 
 };
\ No newline at end of file
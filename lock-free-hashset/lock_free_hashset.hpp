@@ -0,0 +1,124 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <functional>
+#include <new>
+
+#include "../lock-free-linklist/lock_free_linklist.hpp"
+
+//hash set over a fixed number of LockFreeSetList buckets sharing one node pool and one EpochReclaimer
+//a node is just the element and its next pointer, no value and no changing flag as when using LockFreeHashMap for a set
+//the bucket count does not change, so size it for about one element per bucket
+template<typename T>
+class LockFreeHashSet {
+
+private:
+    using List = LockFreeSetList<T>;
+    using Node = typename List::Node;
+
+    //contains_many hashes and prefetches this many buckets ahead of walking them
+    static constexpr size_t prefetch_batch = 8;
+
+    uint64_t bucket_mask;
+    //the lists sit next to each other, a bucket's head node is found without chasing a pointer
+    List* buckets;
+    std::atomic<uint64_t> element_count;
+
+    LockFreeMemoryPool<Node>* pool;
+    EpochReclaimer<Node>* reclaimer;
+
+private:
+
+    List& bucket_of(const T& value) {
+        uint64_t h = std::hash<T>()(value) * 0x9e3779b97f4a7c15ull;
+        return buckets[(h >> 32) & bucket_mask];
+    }
+
+public:
+
+    LockFreeHashSet() = delete;
+
+    LockFreeHashSet(const LockFreeHashSet&) = delete;
+
+    LockFreeHashSet(const LockFreeHashSet&&) = delete;
+
+    LockFreeHashSet& operator = (const LockFreeHashSet&) = delete;
+
+    LockFreeHashSet& operator = (const LockFreeHashSet&&) = delete;
+
+    //_size is the bucket count rounded up to pow of 2, the pool starts with as many nodes and grows on demand
+    //magazine_size and background_reclaim as in LockFreeHashMap
+    explicit LockFreeHashSet(uint32_t _size, uint32_t magazine_size = 0, bool background_reclaim = false) {
+        assert(_size > 0 && _size <= 0x80000000u);
+        uint64_t count = _size == 1 ? 1 : 1ull << (64 - __builtin_clzll(uint64_t(_size) - 1));
+        bucket_mask = count - 1;
+        element_count.store(0, std::memory_order_relaxed);
+        pool = new LockFreeMemoryPool<Node>(count, magazine_size);
+        reclaimer = new EpochReclaimer<Node>(pool, background_reclaim);
+        buckets = static_cast<List*>(::operator new(sizeof(List) * count, std::nothrow));
+        if (buckets == nullptr) {
+            std::cerr << "Memory allocation failed for lock free hashset\n";
+            exit(0);
+        }
+        for (uint64_t b = 0; b < count; ++b) {
+            new (&buckets[b]) List(pool, reclaimer);
+        }
+    }
+
+    //the lists and the reclaimer hand their nodes back to the pool, so they go first
+    ~LockFreeHashSet() {
+        for (uint64_t b = 0; b <= bucket_mask; ++b) {
+            buckets[b].~List();
+        }
+        ::operator delete(buckets);
+        delete reclaimer;
+        delete pool;
+    }
+
+    //true when value was newly added
+    bool insert(const T& value) {
+        bool inserted = bucket_of(value).insert(value);
+        if (inserted) element_count.fetch_add(1, std::memory_order_relaxed);
+        return inserted;
+    }
+
+    bool contains(const T& value) {
+        return bucket_of(value).search(value);
+    }
+
+    //true when this call removed value
+    bool erase(const T& value) {
+        bool erased = bucket_of(value).remove(value);
+        if (erased) element_count.fetch_sub(1, std::memory_order_relaxed);
+        return erased;
+    }
+
+    //found[i] = contains(values[i]) for the whole batch, returns how many were found
+    //the batch collects once and runs in one epoch, so the lookups inside it skip both, and buckets are prefetched a few lookups ahead
+    size_t contains_many(const T* values, size_t n, bool* found) {
+        size_t hits = 0;
+        reclaimer->collect();
+        int index = reclaimer->enter();
+        List* lists[prefetch_batch];
+        for (size_t i = 0; i < n; i += prefetch_batch) {
+            size_t count = n - i < prefetch_batch ? n - i : prefetch_batch;
+            for (size_t j = 0; j < count; ++j) {
+                lists[j] = &bucket_of(values[i + j]);
+                __builtin_prefetch(lists[j]);
+            }
+            for (size_t j = 0; j < count; ++j) {
+                found[i + j] = lists[j]->lookup(values[i + j]);
+                hits += found[i + j];
+            }
+        }
+        reclaimer->leave(index);
+        return hits;
+    }
+
+    uint64_t size() const {
+        return element_count.load(std::memory_order_relaxed);
+    }
+
+};
\ No newline at end of file
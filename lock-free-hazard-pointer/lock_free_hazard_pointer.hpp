@@ -0,0 +1,181 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+#include "../lock-free-memorypool/lock_free_memorypool.hpp"
+#include "../lock-free-common/lock_free_thread_local.hpp"
+
+//reclamation policy with hazard pointers (Michael), same interface as EpochReclaimer
+//every thread owns hazard_count published pointers per nesting level and a private retire list, a retired node is only
+//freed once no hazard points at it, so a stalled thread pins a few nodes instead of everything retired after it
+//a thread scans all hazards once its retire list reaches twice the number of hazards in use,
+//which frees at least half the list per scan and keeps every retire list bounded
+//a traversal must publish a node and then check it is still linked before dereferencing it, hence validates
+//operations may nest on one thread, e.g. a map call from inside a visit callback, every enter takes the next
+//bank of hazards so the outer operation keeps its protection, guards must be left in reverse order of enter
+template<typename Node>
+class HazardPointerReclaimer {
+
+public:
+
+    //Harris-Michael lists need three: next, cur and prev, plus the node being linked by an insert
+    static constexpr int hazard_count = 4;
+
+    //how deep operations may nest on one thread
+    static constexpr uint32_t max_depth = 4;
+
+    static constexpr bool validates = true;
+
+private:
+
+    static constexpr uint32_t min_threshold = 64;
+
+    struct alignas(64) Slot {
+        std::atomic<Node*> hazards[max_depth][hazard_count] = {};
+        //banks in use by operations of the owning thread
+        uint32_t depth = 0;
+        std::vector<Node*> retired;
+        std::vector<Node*> scratch;
+        uint32_t threshold = min_threshold;
+        //retired.size() for pending(), written by the owning thread only
+        std::atomic<uint64_t> pending{0};
+    };
+
+    friend class LockFreeThreadLocal<HazardPointerReclaimer, Slot>;
+
+    LockFreeMemoryPool<Node>* pool;
+    LockFreeThreadLocal<HazardPointerReclaimer, Slot>* slots;
+
+private:
+
+    //the retire list stays in the slot and is scanned by the next thread registering it, or freed with the reclaimer
+    //the pool is not touched here, its own thread state may already be gone
+    void thread_exit(Slot& slot) {
+        for (uint32_t d = 0; d < max_depth; ++d) {
+            for (int i = 0; i < hazard_count; ++i) {
+                slot.hazards[d][i].store(nullptr, std::memory_order_release);
+            }
+        }
+        slot.depth = 0;
+    }
+
+    void scan(Slot& slot) {
+        //pairs with the fence in protect: a node unlinked before this point is either seen in a hazard here
+        //or its protecting thread fails validation
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<Node*>& hazards = slot.scratch;
+        hazards.clear();
+        uint32_t records = 0;
+        slots->for_each([&](Slot& other) {
+            ++records;
+            for (uint32_t d = 0; d < max_depth; ++d) {
+                for (int i = 0; i < hazard_count; ++i) {
+                    Node* node = other.hazards[d][i].load(std::memory_order_acquire);
+                    if (node) hazards.push_back(node);
+                }
+            }
+        });
+        std::sort(hazards.begin(), hazards.end());
+
+        Node* batch[min_threshold];
+        uint32_t count = 0;
+        size_t kept = 0;
+        for (Node* node : slot.retired) {
+            if (std::binary_search(hazards.begin(), hazards.end(), node)) {
+                slot.retired[kept++] = node;
+                continue;
+            }
+            batch[count++] = node;
+            if (count == min_threshold) {
+                pool->deallocate_n(batch, count);
+                count = 0;
+            }
+        }
+        pool->deallocate_n(batch, count);
+        slot.retired.resize(kept);
+        slot.pending.store(kept, std::memory_order_relaxed);
+        //every record can publish hazard_count hazards on each of its max_depth banks
+        uint32_t bound = 2 * hazard_count * max_depth * records;
+        slot.threshold = kept + (bound > min_threshold ? bound : min_threshold);
+    }
+
+public:
+
+    struct Guard {
+        Slot* slot;
+        uint32_t depth;
+    };
+
+    HazardPointerReclaimer() = delete;
+
+    HazardPointerReclaimer(const HazardPointerReclaimer&) = delete;
+
+    HazardPointerReclaimer(const HazardPointerReclaimer&&) = delete;
+
+    HazardPointerReclaimer& operator = (const HazardPointerReclaimer&) = delete;
+
+    HazardPointerReclaimer& operator = (const HazardPointerReclaimer&&) = delete;
+
+    //the pool stays owned by the caller and must outlive the reclaimer
+    //scans always run on the retiring thread, there is no background mode and the flag is ignored
+    explicit HazardPointerReclaimer(LockFreeMemoryPool<Node>* _pool, bool = false) {
+        pool = _pool;
+        slots = new LockFreeThreadLocal<HazardPointerReclaimer, Slot>(this);
+    }
+
+    //nodes still retired go back to the pool, nobody may be inside an operation any more
+    ~HazardPointerReclaimer() {
+        slots->for_each([&](Slot& slot) {
+            for (Node* node : slot.retired) {
+                pool->deallocate(node);
+            }
+            slot.retired.clear();
+        });
+        delete slots;
+    }
+
+    Guard enter() {
+        Slot& slot = slots->get();
+        assert(slot.depth < max_depth);
+        return Guard{&slot, slot.depth++};
+    }
+
+    //only clears the guard's own bank, hazards of an enclosing operation stay published
+    void leave(Guard guard) {
+        assert(guard.depth + 1 == guard.slot->depth);
+        for (int i = 0; i < hazard_count; ++i) {
+            guard.slot->hazards[guard.depth][i].store(nullptr, std::memory_order_release);
+        }
+        guard.slot->depth = guard.depth;
+    }
+
+    //the caller still has to check node is reachable after this, otherwise it may already be retired
+    void protect(Guard guard, int i, Node* node) {
+        guard.slot->hazards[guard.depth][i].store(node, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void retire(Node* node) {
+        Slot& slot = slots->get();
+        slot.retired.push_back(node);
+        slot.pending.store(slot.retired.size(), std::memory_order_relaxed);
+        if (slot.retired.size() >= slot.threshold) scan(slot);
+    }
+
+    //scans are amortized over retire, nothing to do up front
+    void collect() {}
+
+    //retired nodes not yet back in the pool, a snapshot that may be off while threads retire
+    uint64_t pending() {
+        uint64_t total = 0;
+        slots->for_each([&](Slot& slot) {
+            total += slot.pending.load(std::memory_order_relaxed);
+        });
+        return total;
+    }
+
+};
\ No newline at end of file
@@ -1,225 +1,183 @@
+#pragma once
+
 #include <iostream>
 #include <atomic>
 #include <cassert>
 
-#include "../lock-free-stack/lock_free_stack.hpp"
-
-class EpochManager {
-
-private:
-
-    static constexpr int max_threads = 128;
-    static constexpr uint64_t access = -1ull;
-    std::atomic<uint64_t> globaepoch;
-    std::atomic<uint64_t> localepoch[max_threads];
-
-
-public:
-
-    EpochManager() {
-        globaepoch.store(0);
-        for (int i = 0; i < max_threads; ++i) {
-            localepoch[i].store(access);
-        }
-    }
-
-    uint64_t get_epoch() {
-        return globaepoch.fetch_add(1, std::memory_order_acq_rel);
-    }
-
-    int lockepoch() {
-        uint64_t epoch = get_epoch();
-        uint64_t is_access = access;
-        for (int i = 0; i < max_threads; ++i) {
-            if (localepoch[i].compare_exchange_strong(is_access, epoch, std::memory_order_acquire)) {
-                return i;
-            }
-        }
-        std::cerr << "threads is too much\n";
-        exit(0);
-        return -1;
-    }
-
-    void unlockepoch(int index) {
-        localepoch[index].store(access, std::memory_order_release);
-    }
-
-    uint64_t minepoch() {
-        uint64_t min_e = access; 
-        for (int i = 0; i < max_threads; ++i) {
-            uint64_t epoch = localepoch[i].load(std::memory_order_acquire);
-            if (min_e > epoch) {
-                min_e = epoch;
-            }
-        }
-        return min_e;
-    }
-
-};
+#include "../lock-free-epoch/lock_free_epoch_reclaimer.hpp"
 
+//unordered set of T, also reachable under its old name LockFreeLinklist
+//new elements are appended at the tail so two inserts of one value can not both succeed
+//a node is deleted by marking bit 0 of its next and then unlinked by whoever passes it (Michael),
+//search only steps over marked nodes and writes nothing
 template<typename T>
-class LockFreeLinklist {
+class LockFreeSetList {
 
-private:
+public:
 
+    //public so the owner can build the shared pool and reclaimer
     struct alignas(8) Node {
         T data;
         std::atomic<Node*> next;
     };
 
-    struct DeleteNode {
-        Node* node;
-        uint64_t version;
-    };
+private:
 
-    //These resources come from outside, they need to be released manually by the upper application 
-    LockFreeStack<DeleteNode>* remove_set;
+    //These resources come from outside, they need to be released manually by the upper application
     LockFreeMemoryPool<Node>* pool;
-    EpochManager* epoch;
+    EpochReclaimer<Node>* reclaimer;
 
     Node head;
 
 private :
 
-    bool is_remove(Node* node) {
-        return reinterpret_cast<uint64_t>(node->next.load(std::memory_order_acquire)) & 1;
+    static bool is_remove(Node* next) {
+        return reinterpret_cast<uint64_t>(next) & 1;
     }
 
-    Node* get_next(Node* node) {
-        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(node->next.load(std::memory_order_acquire)) & ~uint64_t(3));
+    static Node* unmark(Node* next) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) & ~uint64_t(1));
     }
 
-    Node* get_remove_next(Node* node) {
-        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(node->next.load(std::memory_order_acquire)) & ~uint64_t(2));
+    static Node* mark(Node* next) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) | 1);
     }
 
-    void try_remove_from_link(Node* prev, Node* node) {
-        if (!is_remove(node)) return;
-        Node* next = get_next(node);
-        Node* remo_next = get_remove_next(node);
-        Node* mark_next = reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) | 2);
-        if (!node->next.compare_exchange_strong(remo_next, mark_next, std::memory_order_acq_rel)) {
-            return;
-        }
-        if (!prev->next.compare_exchange_strong(node, next, std::memory_order_acq_rel)) {
-            node->next.store(remo_next, std::memory_order_release);
-            return;
-        }
-        DeleteNode deletenode = {node, epoch->get_epoch()};
-        remove_set->push(deletenode);
-    }
-
-    void try_remove_to_pool() {
-        DeleteNode deletenode;
-        while (remove_set.pop(deletenode)) {
-            if (deletenode->version > epoch->minepoch()) {
-                remove_set.push(deletenode);
-                break;
+    //cur is the node holding value, or nullptr with prev the last node, prev->next was cur
+    //marked nodes met on the way are unlinked and retired
+    bool find(const T& value, Node*& prev, Node*& cur) {
+        while (true) {
+            prev = &head;
+            cur = unmark(head.next.load(std::memory_order_acquire));
+            bool restart = false;
+            while (cur) {
+                Node* next = cur->next.load(std::memory_order_acquire);
+                if (is_remove(next)) {
+                    Node* expected = cur;
+                    if (!prev->next.compare_exchange_strong(expected, unmark(next), std::memory_order_acq_rel)) {
+                        restart = true;
+                        break;
+                    }
+                    reclaimer->retire(cur);
+                    cur = unmark(next);
+                    continue;
+                }
+                if (cur->data == value) return true;
+                prev = cur;
+                cur = next;
             }
-            else pool->deallocate(deletenode.node);
+            if (!restart) return false;
         }
     }
 
-    
-
 public:
 
-    LockFreeLinklist() = delete;
+    LockFreeSetList() = delete;
 
-    LockFreeLinklist(const LockFreeLinklist&) = delete;
+    LockFreeSetList(const LockFreeSetList&) = delete;
 
-    LockFreeLinklist(const LockFreeLinklist&&) = delete;
+    LockFreeSetList(const LockFreeSetList&&) = delete;
 
-    LockFreeLinklist& operator = (const LockFreeLinklist&) = delete;
+    LockFreeSetList& operator = (const LockFreeSetList&) = delete;
 
-    LockFreeLinklist& operator = (const LockFreeLinklist&&) = delete;
+    LockFreeSetList& operator = (const LockFreeSetList&&) = delete;
 
-    explicit LockFreeLinklist(LockFreeMemoryPool<Node>* _pool, LockFreeStack<DeleteNode>* _remove_set, EpochManager* _epoch) {
+    explicit LockFreeSetList(LockFreeMemoryPool<Node>* _pool, EpochReclaimer<Node>* _reclaimer) {
         head.next = nullptr;
         pool = _pool;
-        remove_set = _remove_set;
-        epoch = _epoch;
+        reclaimer = _reclaimer;
     }
 
-    ~LockFreeLinklist() {
-        Node* node = head.next.load(std::memory_order_acquire);
-        DeleteNode deletenode;
-        while (remove_set->pop(deletenode)) {
-            pool->deallocate(deletenode.node);
-        }
+    //only the linked nodes are freed here, retired ones belong to the reclaimer
+    ~LockFreeSetList() {
+        Node* node = unmark(head.next.load(std::memory_order_acquire));
         while (node) {
-            Node* next = get_next(node);
+            Node* next = unmark(node->next.load(std::memory_order_acquire));
             pool->deallocate(node);
             node = next;
         }
     }
 
-    void insert(const T& value) {
-        try_remove_to_pool();
-        int index = epoch->lockepoch();
+    //true when value was not in the list yet
+    bool insert(const T& value) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
 
-        Node* new_node = pool->allocate();
-        new_node->data = value;
-        new_node->next.store(nullptr, std::memory_order_release);
-        while (true) {
-            Node* prev = &head;
-            Node* node = prev->next.load(std::memory_order_acquire);
-            while (node) {
-                try_remove_from_link(prev, node);
-                if (!is_remove(node) && node->data == value) {
-                    pool->deallocate(new_node);
-                    break;
+        Node* new_node = nullptr;
+        Node* prev;
+        Node* node;
+        bool inserted = false;
+        while (!find(value, prev, node)) {
+            if (new_node == nullptr) {
+                new_node = pool->allocate();
+                if (new_node == nullptr) {
+                    std::cerr << "Pool size is too small\n";
+                    exit(0);
                 }
-                prev = node;
-                node = get_next(node);
+                new_node->data = value;
+                new_node->next.store(nullptr, std::memory_order_relaxed);
             }
-            if (node != nullptr) break;
-            if(prev->next.compare_exchange_strong(node, new_node, std::memory_order_acq_rel)) {
+            //fails when something was appended after prev or prev got marked, both need a new scan
+            if (prev->next.compare_exchange_strong(node, new_node, std::memory_order_acq_rel)) {
+                inserted = true;
                 break;
             }
         }
+        if (!inserted && new_node) pool->deallocate(new_node);
 
-        epoch->unlockepoch(index);
+        reclaimer->leave(index);
+        return inserted;
     }
 
     bool search(const T& value) {
-        try_remove_to_pool();
-        int index = epoch->lockepoch();
+        reclaimer->collect();
+        int index = reclaimer->enter();
 
-        Node* prev = &head;
-        Node* node = head.next.load(std::memory_order_acquire);
-        while (node) {
-            try_remove_from_link(prev, node);
-            if (!is_remove(node) && node->data == value) break;
-            prev = node;
-            node = get_next(node);
-        }
+        bool found = lookup(value);
 
-        epoch->unlockepoch(index);
-        return (node != nullptr);
+        reclaimer->leave(index);
+        return found;
     }
 
-    void remove(const T& value) {
-        try_remove_to_pool();
-        int index = epoch->lockepoch();
-
-        Node* prev = &head;
-        Node* node = prev->next.load(std::memory_order_acquire);
+    //search for callers that batch lookups in an epoch of their own, must run between enter and leave
+    bool lookup(const T& value) {
+        Node* node = unmark(head.next.load(std::memory_order_acquire));
         while (node) {
-            try_remove_from_link(prev, node);
-            if (!is_remove(node) && node->data == value) break;
-            prev = node;
-            node = get_next(node);
+            Node* next = node->next.load(std::memory_order_acquire);
+            if (!is_remove(next) && node->data == value) break;
+            node = unmark(next);
         }
+        return (node != nullptr);
+    }
+
+    //true when this call removed value
+    bool remove(const T& value) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
 
-        if (node != nullptr) {
-            Node* next = get_next(node);
-            Node* mark_next = reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) | 1);
-            node->next.compare_exchange_strong(next, mark_next, std::memory_order_acq_rel);
-            try_remove_from_link(prev, node);
+        bool removed = false;
+        Node* prev;
+        Node* node;
+        if (find(value, prev, node)) {
+            Node* next = node->next.load(std::memory_order_acquire);
+            while (!is_remove(next)) {
+                if (node->next.compare_exchange_weak(next, mark(next), std::memory_order_acq_rel)) {
+                    removed = true;
+                    break;
+                }
+            }
+            if (removed) {
+                Node* expected = node;
+                if (prev->next.compare_exchange_strong(expected, unmark(next), std::memory_order_acq_rel)) reclaimer->retire(node);
+                else find(value, prev, node);
+            }
         }
 
-        epoch->unlockepoch(index);
+        reclaimer->leave(index);
+        return removed;
     }
 
-};
\ No newline at end of file
+};
+
+template<typename T>
+using LockFreeLinklist = LockFreeSetList<T>;
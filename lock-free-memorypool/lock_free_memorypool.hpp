@@ -1,38 +1,281 @@
+#pragma once
+
 #include <iostream>
 #include <cassert>
 #include <atomic>
+#include <utility>
+
+#include "../lock-free-common/lock_free_thread_local.hpp"
+#include "../lock-free-common/lock_free_tagged_head.hpp"
+#include "../lock-free-common/lock_free_memory_backing.hpp"
 
+//nodes are addressed by 32 bit indices that run across all chunks, free nodes link through a 32 bit next
+//and the free stack head is a LockFreeTaggedHead, so the pool holds up to 4G - 1 nodes
+//the next links live in a side array per chunk like the allocated flags, so a node is exactly a T
 template<typename T>
 class LockFreeMemoryPool {
 
+public:
+
+    static constexpr uint32_t null_index = LockFreeTaggedHead::null_index;
+
 private:
     struct Node {
         T data;
-        Node* next;
     };
 
-    Node* pool;
-    uint32_t pool_size;
+    //a chain of free nodes linked through next, owned by one thread
+    struct Chain {
+        uint32_t head = null_index;
+        uint32_t tail = null_index;
+        uint32_t count = 0;
+    };
+
+    //Bonwick style pair: allocations and frees work on loaded, previous is either full or empty
+    struct Magazine {
+        Chain loaded;
+        Chain previous;
+    };
+
+    //chunk c holds base_size << c nodes, chunks are only added at the end and trimmed from the end
+    struct Chunk {
+        Node* nodes;
+        std::atomic<uint32_t>* next;
+        std::atomic<bool>* allocated;
+        uint32_t size;
+        //mapped length of nodes, 0 when they came from the heap
+        size_t bytes;
+    };
+
+    friend class LockFreeThreadLocal<LockFreeMemoryPool, Magazine>;
+
+    static constexpr int max_chunks = 32;
 
-    std::atomic<uint64_t> top;
-    std::atomic<bool>* allocated;
+    std::atomic<Chunk*> chunks[max_chunks];
+    uint32_t base_size;
+    uint32_t base_shift;
 
-    static constexpr uint64_t ptr_mask = 0x0000ffffffffffff;
+    LockFreeTaggedHead top;
+
+    LockFreeMemoryBacking backing;
+
+    //0 disables the per thread cache
+    uint32_t magazine_size;
+    LockFreeThreadLocal<LockFreeMemoryPool, Magazine>* magazines;
 
 private:
 
-    uint64_t pack(Node* node, uint16_t version) {
-        uint64_t v = version;
-        uint64_t ptr = reinterpret_cast<uint64_t>(node);
-        return (v << 48) | (ptr & ptr_mask);
+    //chunk c covers the indices [chunk_begin(c), chunk_begin(c + 1))
+    uint64_t chunk_begin(int c) {
+        return (uint64_t(base_size) << c) - base_size;
+    }
+
+    int chunk_of(uint32_t index) {
+        return 63 - __builtin_clzll((uint64_t(index) + base_size) >> base_shift);
+    }
+
+    Node* node_at(uint32_t index) {
+        int c = chunk_of(index);
+        return &chunks[c].load(std::memory_order_acquire)->nodes[index - chunk_begin(c)];
+    }
+
+    std::atomic<uint32_t>& next_at(uint32_t index) {
+        int c = chunk_of(index);
+        return chunks[c].load(std::memory_order_acquire)->next[index - chunk_begin(c)];
+    }
+
+    std::atomic<bool>& allocated_at(uint32_t index) {
+        int c = chunk_of(index);
+        return chunks[c].load(std::memory_order_acquire)->allocated[index - chunk_begin(c)];
+    }
+
+    //null_index for a pointer that does not belong to any chunk
+    uint32_t find_index(Node* node) {
+        for (int c = 0; c < max_chunks; ++c) {
+            Chunk* chunk = chunks[c].load(std::memory_order_acquire);
+            if (chunk == nullptr) break;
+            if (node >= chunk->nodes && node < chunk->nodes + chunk->size) {
+                return chunk_begin(c) + (node - chunk->nodes);
+            }
+        }
+        return null_index;
+    }
+
+    //the index is only valid if its chunk currently exists
+    bool owns(uint32_t index) {
+        if (index == null_index) return false;
+        int c = chunk_of(index);
+        return c < max_chunks && chunks[c].load(std::memory_order_acquire) != nullptr;
+    }
+
+    //pop up to n nodes off the global stack with one CAS
+    Chain pop_chain(uint32_t n) {
+        LockFreeTaggedHead::Value old_top = top.load();
+        Chain chain;
+        while (true) {
+            if (old_top.index == null_index) return Chain();
+            chain.head = old_top.index;
+            chain.tail = chain.head;
+            chain.count = 1;
+            uint32_t next = next_at(chain.tail).load(std::memory_order_relaxed);
+            while (chain.count < n && next != null_index) {
+                chain.tail = next;
+                ++chain.count;
+                next = next_at(next).load(std::memory_order_relaxed);
+            }
+            if (top.compare_exchange(old_top, next)) return chain;
+        }
+    }
+
+    //push a chain of free nodes back onto the global stack with one CAS
+    void push_chain(const Chain& chain) {
+        if (chain.count == 0) return;
+        std::atomic<uint32_t>& tail = next_at(chain.tail);
+        LockFreeTaggedHead::Value cur_top = top.load();
+        do {
+            tail.store(cur_top.index, std::memory_order_relaxed);
+        } while (top.compare_exchange(cur_top, chain.head) == false);
+    }
+
+    void link(Chain& chain, uint32_t index) {
+        next_at(index).store(chain.head, std::memory_order_relaxed);
+        if (chain.count == 0) chain.tail = index;
+        chain.head = index;
+        ++chain.count;
+    }
+
+    //mapped nodes are constructed in place only after the mapping is bound, so first touch lands on the right node
+    Node* new_nodes(uint32_t size, size_t& bytes) {
+        if (backing.is_heap()) {
+            bytes = 0;
+            return new (std::nothrow) Node[size];
+        }
+        bytes = sizeof(Node) * size_t(size);
+        void* addr = backing.map(bytes);
+        if (addr == nullptr) return nullptr;
+        Node* nodes = reinterpret_cast<Node*>(addr);
+        for (uint32_t i = 0; i < size; ++i) {
+            new (&nodes[i]) Node;
+        }
+        return nodes;
+    }
+
+    void delete_nodes(Node* nodes, uint32_t size, size_t bytes) {
+        if (nodes == nullptr) return;
+        if (bytes == 0) {
+            delete[] nodes;
+            return;
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            nodes[i].~Node();
+        }
+        backing.unmap(nodes, bytes);
+    }
+
+    Chunk* new_chunk(uint64_t begin, uint32_t size) {
+        Chunk* chunk = new (std::nothrow) Chunk;
+        if (chunk == nullptr) return nullptr;
+        chunk->size = size;
+        chunk->nodes = new_nodes(size, chunk->bytes);
+        chunk->next = new (std::nothrow) std::atomic<uint32_t>[size];
+        chunk->allocated = new (std::nothrow) std::atomic<bool>[size];
+        if (chunk->nodes == nullptr || chunk->next == nullptr || chunk->allocated == nullptr) {
+            delete_nodes(chunk->nodes, size, chunk->bytes);
+            delete[] chunk->next;
+            delete[] chunk->allocated;
+            delete chunk;
+            return nullptr;
+        }
+        for (uint32_t i = 0; i < size; ++i) {
+            chunk->next[i].store(i + 1 < size ? uint32_t(begin + i + 1) : null_index, std::memory_order_relaxed);
+            chunk->allocated[i].store(false, std::memory_order_relaxed);
+        }
+        return chunk;
     }
 
-    Node* unpackPtr(uint64_t combined) {
-        return reinterpret_cast<Node*>(combined & ptr_mask);
+    void delete_chunk(Chunk* chunk) {
+        delete_nodes(chunk->nodes, chunk->size, chunk->bytes);
+        delete[] chunk->next;
+        delete[] chunk->allocated;
+        delete chunk;
     }
 
-    uint16_t unpackVersion(uint64_t combined) {
-        return combined >> 48;
+    //add the next chunk and push its nodes, false once the pool can not grow any more
+    //racing growers build their own chunk, the loser of the CAS frees it and reports success
+    bool grow() {
+        for (int c = 0; c < max_chunks; ++c) {
+            if (chunks[c].load(std::memory_order_acquire) != nullptr) continue;
+            if (chunk_begin(c + 1) > null_index) return false;
+            if (top.load().index != null_index) return true;
+            Chunk* chunk = new_chunk(chunk_begin(c), base_size << c);
+            if (chunk == nullptr) return false;
+            Chunk* expected = nullptr;
+            if (chunks[c].compare_exchange_strong(expected, chunk, std::memory_order_acq_rel)) {
+                push_chain({uint32_t(chunk_begin(c)), uint32_t(chunk_begin(c + 1) - 1), chunk->size});
+            }
+            else {
+                delete_chunk(chunk);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    uint32_t magazine_allocate(bool may_grow) {
+        Magazine& magazine = magazines->get();
+        if (magazine.loaded.count == 0) {
+            if (magazine.previous.count != 0) std::swap(magazine.loaded, magazine.previous);
+            else {
+                do {
+                    magazine.loaded = pop_chain(magazine_size);
+                } while (magazine.loaded.count == 0 && may_grow && grow());
+            }
+            if (magazine.loaded.count == 0) return null_index;
+        }
+        uint32_t index = magazine.loaded.head;
+        magazine.loaded.head = next_at(index).load(std::memory_order_relaxed);
+        --magazine.loaded.count;
+        return index;
+    }
+
+    void magazine_deallocate(uint32_t index) {
+        Magazine& magazine = magazines->get();
+        if (magazine.loaded.count == magazine_size) {
+            push_chain(magazine.previous);
+            magazine.previous = magazine.loaded;
+            magazine.loaded = Chain();
+        }
+        link(magazine.loaded, index);
+    }
+
+    uint32_t take(bool may_grow) {
+        uint32_t index;
+        if (magazine_size) {
+            index = magazine_allocate(may_grow);
+            if (index == null_index) return null_index;
+        }
+        else {
+            LockFreeTaggedHead::Value old_top = top.load();
+            while (true) {
+                if (old_top.index == null_index) {
+                    if (!may_grow || !grow()) return null_index;
+                    old_top = top.load();
+                    continue;
+                }
+                if (top.compare_exchange(old_top, next_at(old_top.index).load(std::memory_order_relaxed))) break;
+            }
+            index = old_top.index;
+        }
+
+        allocated_at(index).store(true, std::memory_order_release);
+        return index;
+    }
+
+    //called by the registry when a thread exits, its cached nodes go back to the global stack
+    void thread_exit(Magazine& magazine) {
+        push_chain(magazine.loaded);
+        push_chain(magazine.previous);
+        magazine = Magazine();
     }
 
 public:
@@ -47,57 +290,165 @@ public:
 
     LockFreeMemoryPool& operator = (const LockFreeMemoryPool&&) = delete;
 
-    explicit LockFreeMemoryPool(uint32_t size) {
-        pool_size = size;
-        pool = new Node[size];
-        allocated = new std::atomic<bool>[size];
-        for (int i = 0; i < size - 1; ++i) {
-            pool[i].next = &pool[i + 1];
-            allocated[i].store(false);
+    //size is rounded up to pow of 2 and is the first chunk, the pool grows by doubling when it runs dry
+    //magazine_size > 0 puts a per thread cache of up to 2 * magazine_size nodes in front of the global stack
+    //_backing picks heap, mmap or huge page storage for the chunks and optionally binds them to a NUMA node
+    explicit LockFreeMemoryPool(uint32_t size, uint32_t _magazine_size = 0, LockFreeMemoryBacking _backing = LockFreeMemoryBacking()) {
+        assert(size > 0 && size <= 0x80000000u);
+        base_size = size == 1 ? 1 : 1u << (32 - __builtin_clz(size - 1));
+        base_shift = __builtin_ctz(base_size);
+        magazine_size = _magazine_size;
+        backing = _backing;
+        magazines = magazine_size ? new LockFreeThreadLocal<LockFreeMemoryPool, Magazine>(this) : nullptr;
+        for (int c = 0; c < max_chunks; ++c) {
+            chunks[c].store(nullptr, std::memory_order_relaxed);
+        }
+        if (!grow()) {
+            std::cerr << "Memory allocation failed for lock free pool\n";
+            exit(0);
         }
-        pool[size - 1].next = nullptr;
-        allocated[size - 1].store(false);
-        top.store(pack(pool, 0));
     }
 
     ~LockFreeMemoryPool() {
-        delete[] pool;
-        delete[] allocated;
+        delete magazines;
+        for (int c = 0; c < max_chunks; ++c) {
+            Chunk* chunk = chunks[c].load(std::memory_order_acquire);
+            if (chunk) delete_chunk(chunk);
+        }
+    }
+
+    //index handle of a free node, null_index when out of memory
+    //a handle stays valid until it is deallocated and can be turned into a pointer with at()
+    uint32_t allocate_index() {
+        return take(true);
+    }
+
+    void deallocate_index(uint32_t index) {
+        bool status = true;
+        if (!owns(index)) return;
+        if (allocated_at(index).compare_exchange_strong(status, false, std::memory_order_acq_rel) == false) return;
+
+        if (magazine_size) {
+            magazine_deallocate(index);
+            return;
+        }
+
+        Chain chain;
+        link(chain, index);
+        push_chain(chain);
+    }
+
+    T* at(uint32_t index) {
+        return &node_at(index)->data;
+    }
+
+    //null_index for a pointer that did not come from this pool
+    uint32_t index_of(T* ptr) {
+        return find_index(reinterpret_cast<Node*>(ptr));
     }
 
     T* allocate() {
-        uint64_t old_top;
-        uint64_t nex_top;
-        Node* node;
-        do {
-            old_top = top.load(std::memory_order_acquire);
-            node = unpackPtr(old_top);
-            if (node == nullptr) return nullptr;
-            nex_top = pack(node->next, unpackVersion(old_top) + 1);
-        } while (top.compare_exchange_strong(old_top, nex_top, std::memory_order_acq_rel) == false);
+        uint32_t index = allocate_index();
+        if (index == null_index) return nullptr;
+        return at(index);
+    }
 
-        uint32_t index = node - pool;
-        allocated[index].store(true, std::memory_order_release);
-        return &node->data;
+    //a node the pool already owns, nullptr where allocate would add a chunk
+    T* try_allocate() {
+        uint32_t index = take(false);
+        if (index == null_index) return nullptr;
+        return at(index);
     }
 
     void deallocate(T* ptr) {
-        Node* node = reinterpret_cast<Node*>(ptr);
-        uint32_t index = node - pool;
-        bool status = true;
+        uint32_t index = index_of(ptr);
+        if (index == null_index) return;
+        deallocate_index(index);
+    }
 
-        if (node < pool || index >= pool_size) return;
-        if (allocated[index].compare_exchange_strong(status, false, std::memory_order_acq_rel) == false) return;
+    //allocate up to n nodes, taking them off the global stack a chain at a time with one CAS per chain
+    //bypasses the thread magazines, returns how many pointers were written to out, fewer only when out of memory
+    uint32_t allocate_n(T** out, uint32_t n) {
+        uint32_t got = 0;
+        while (got < n) {
+            Chain chain = pop_chain(n - got);
+            if (chain.count == 0) {
+                if (!grow()) break;
+                continue;
+            }
+            uint32_t index = chain.head;
+            for (uint32_t i = 0; i < chain.count; ++i) {
+                uint32_t next = next_at(index).load(std::memory_order_relaxed);
+                allocated_at(index).store(true, std::memory_order_release);
+                out[got++] = &node_at(index)->data;
+                index = next;
+            }
+        }
+        return got;
+    }
 
-        uint64_t new_top, cur_top;
-        uint16_t v;
+    //free n pointers with a single CAS, foreign pointers and double frees are skipped like in deallocate
+    void deallocate_n(T** ptrs, uint32_t n) {
+        Chain chain;
+        for (uint32_t i = 0; i < n; ++i) {
+            Node* node = reinterpret_cast<Node*>(ptrs[i]);
+            uint32_t index = find_index(node);
+            bool status = true;
+            if (index == null_index) continue;
+            if (allocated_at(index).compare_exchange_strong(status, false, std::memory_order_acq_rel) == false) continue;
+            link(chain, index);
+        }
+        push_chain(chain);
+    }
 
-        do {
-            cur_top = top.load(std::memory_order_acquire);
-            v = unpackVersion(cur_top) + 1;
-            node->next = unpackPtr(cur_top);
-            new_top = pack(node, v);
-        } while (top.compare_exchange_strong(cur_top, new_top, std::memory_order_acq_rel) == false);
+    //number of nodes the pool currently owns
+    uint64_t capacity() {
+        uint64_t total = 0;
+        for (int c = 0; c < max_chunks; ++c) {
+            Chunk* chunk = chunks[c].load(std::memory_order_acquire);
+            if (chunk == nullptr) break;
+            total += chunk->size;
+        }
+        return total;
     }
 
+    //give trailing chunks whose nodes are all on the global free stack back to the OS, returns the nodes released
+    //the first chunk is always kept, nodes parked in thread magazines count as in use
+    //only call this while no other thread is using the pool
+    uint64_t trim() {
+        LockFreeTaggedHead::Value cur_top = top.load();
+        uint32_t first = cur_top.index;
+        while (top.compare_exchange(cur_top, null_index) == false) first = cur_top.index;
+
+        int last = 0;
+        while (last + 1 < max_chunks && chunks[last + 1].load(std::memory_order_relaxed)) ++last;
+
+        uint32_t free_count[max_chunks] = {};
+        for (uint32_t index = first; index != null_index; index = next_at(index).load(std::memory_order_relaxed)) {
+            ++free_count[chunk_of(index)];
+        }
+
+        int keep = last;
+        while (keep > 0 && free_count[keep] == chunks[keep].load(std::memory_order_relaxed)->size) --keep;
+
+        //relink the survivors before the trimmed chunks go away, the walk still passes through them
+        Chain chain;
+        uint32_t index = first;
+        while (index != null_index) {
+            uint32_t next = next_at(index).load(std::memory_order_relaxed);
+            if (chunk_of(index) <= keep) link(chain, index);
+            index = next;
+        }
+
+        uint64_t released = 0;
+        for (int c = last; c > keep; --c) {
+            Chunk* chunk = chunks[c].load(std::memory_order_relaxed);
+            chunks[c].store(nullptr, std::memory_order_release);
+            released += chunk->size;
+            delete_chunk(chunk);
+        }
+
+        push_chain(chain);
+        return released;
+    }
 };
\ No newline at end of file
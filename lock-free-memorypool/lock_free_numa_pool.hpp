@@ -0,0 +1,150 @@
+#pragma once
+
+#include <iostream>
+#include <cassert>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "lock_free_memorypool.hpp"
+
+//one LockFreeMemoryPool per NUMA node, each bound to its node
+//only nodes that are online get a shard, the rest of the possible node ids stay empty
+//allocate serves the calling thread's node first, then takes free nodes from remote shards, and only grows a shard
+//once none of them has a free node left, local first, deallocate always returns a node to the shard that owns it
+//and looks in the local shard first, since most nodes are freed on the node that allocated them
+template<typename T>
+class LockFreeNumaPool {
+
+private:
+
+    static constexpr int max_nodes = 64;
+    //a thread asks the kernel for its node once every this many calls, threads rarely move between nodes
+    static constexpr uint32_t node_refresh = 64;
+
+    //indexed by node id, nullptr for nodes that are not online
+    LockFreeMemoryPool<T>* shards[max_nodes];
+    //ids of the online nodes, ascending
+    int online[max_nodes];
+    //position in online of every node id, 0 for the ones that are not online
+    int position[max_nodes];
+    int node_count;
+
+private:
+
+    //mask of the online nodes from a list like "0-1,3", node 0 alone when sysfs is not readable
+    static uint64_t online_nodes() {
+        std::ifstream file("/sys/devices/system/node/online");
+        std::string list;
+        if (!(file >> list)) return 1;
+        uint64_t mask = 0;
+        size_t begin = 0;
+        while (begin < list.size()) {
+            size_t end = list.find_first_of(",", begin);
+            if (end == std::string::npos) end = list.size();
+            std::string range = list.substr(begin, end - begin);
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int n = first; n <= last && n < max_nodes; ++n) {
+                mask |= 1ull << n;
+            }
+            begin = end + 1;
+        }
+        return mask ? mask : 1;
+    }
+
+    //node of the calling thread, cached per thread and shared by every pool
+    static int current_node() {
+        static thread_local int node = 0;
+        static thread_local uint32_t calls = 0;
+        if (calls++ % node_refresh == 0) {
+            unsigned cpu = 0, fresh = 0;
+            if (syscall(SYS_getcpu, &cpu, &fresh, nullptr) == 0 && fresh < unsigned(max_nodes)) node = int(fresh);
+        }
+        return node;
+    }
+
+    //position of the calling thread's node in online
+    int current_shard() {
+        return position[current_node()];
+    }
+
+public:
+
+    LockFreeNumaPool() = delete;
+
+    LockFreeNumaPool(const LockFreeNumaPool&) = delete;
+
+    LockFreeNumaPool(const LockFreeNumaPool&&) = delete;
+
+    LockFreeNumaPool& operator = (const LockFreeNumaPool&) = delete;
+
+    LockFreeNumaPool& operator = (const LockFreeNumaPool&&) = delete;
+
+    //size and magazine_size are per shard, pages picks the page kind of every shard
+    explicit LockFreeNumaPool(uint32_t size, uint32_t magazine_size = 0, LockFreeMemoryBacking::Pages pages = LockFreeMemoryBacking::Pages::normal) {
+        assert(size > 0);
+        uint64_t mask = online_nodes();
+        node_count = 0;
+        for (int n = 0; n < max_nodes; ++n) {
+            shards[n] = nullptr;
+            position[n] = 0;
+            if (!(mask & (1ull << n))) continue;
+            position[n] = node_count;
+            shards[n] = new LockFreeMemoryPool<T>(size, magazine_size, LockFreeMemoryBacking(pages, n));
+            online[node_count++] = n;
+        }
+    }
+
+    ~LockFreeNumaPool() {
+        for (int i = 0; i < node_count; ++i) {
+            delete shards[online[i]];
+        }
+    }
+
+    //number of online nodes, each with its own shard
+    int nodes() const {
+        return node_count;
+    }
+
+    T* allocate() {
+        int local = current_shard();
+        for (int i = 0; i < node_count; ++i) {
+            T* ptr = shards[online[(local + i) % node_count]]->try_allocate();
+            if (ptr) return ptr;
+        }
+        for (int i = 0; i < node_count; ++i) {
+            T* ptr = shards[online[(local + i) % node_count]]->allocate();
+            if (ptr) return ptr;
+        }
+        return nullptr;
+    }
+
+    //allocate from one online node's shard only, nullptr when it is out of memory
+    T* allocate_on(int node) {
+        assert(node >= 0 && node < max_nodes && shards[node] != nullptr);
+        return shards[node]->allocate();
+    }
+
+    void deallocate(T* ptr) {
+        int local = current_shard();
+        for (int i = 0; i < node_count; ++i) {
+            LockFreeMemoryPool<T>* shard = shards[online[(local + i) % node_count]];
+            uint32_t index = shard->index_of(ptr);
+            if (index != LockFreeMemoryPool<T>::null_index) {
+                shard->deallocate_index(index);
+                return;
+            }
+        }
+    }
+
+    uint64_t capacity() {
+        uint64_t total = 0;
+        for (int i = 0; i < node_count; ++i) {
+            total += shards[online[i]]->capacity();
+        }
+        return total;
+    }
+};
\ No newline at end of file
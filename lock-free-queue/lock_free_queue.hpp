@@ -0,0 +1,250 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <new>
+#include <utility>
+
+#include "../lock-free-memorypool/lock_free_memorypool.hpp"
+#include "../lock-free-stack/lock_free_stack.hpp"
+#include "../lock-free-epoch/lock_free_epoch.hpp"
+
+//unbounded MPMC queue made of a chain of fixed size ring segments
+//a full segment is closed and a fresh one from the pool is linked behind it,
+//drained segments are unlinked from the head and go back to the pool once no reader can still see them
+template<typename T, uint32_t SegmentSize = 1024>
+class LockFreeQueue {
+
+    static_assert(__builtin_popcount(SegmentSize) == 1, "SegmentSize must be pow of 2");
+    //a tombstone's seq (pos + 2) must not read as free to an enqueuer one lap ahead
+    static_assert(SegmentSize >= 4, "SegmentSize must be at least 4");
+
+private:
+
+    static constexpr size_t cache_line = 64;
+    //set in enqueue_pos once the segment takes no more values
+    static constexpr uint32_t closed = 0x80000000u;
+    //close a long lived segment before its positions run into the closed bit
+    static constexpr uint32_t max_pos = closed - SegmentSize;
+
+    struct Slot {
+        alignas(T) unsigned char data[sizeof(T)];
+        std::atomic<uint32_t> seq;
+    };
+
+    struct Segment {
+        alignas(cache_line) std::atomic<uint32_t> enqueue_pos;
+        alignas(cache_line) std::atomic<uint32_t> dequeue_pos;
+        alignas(cache_line) std::atomic<Segment*> next;
+        Slot slots[SegmentSize];
+    };
+
+    struct DeleteNode {
+        Segment* segment;
+        uint64_t version;
+    };
+
+    alignas(cache_line) std::atomic<Segment*> head;
+    alignas(cache_line) std::atomic<Segment*> tail;
+
+    LockFreeMemoryPool<Segment>* pool;
+    LockFreeStack<DeleteNode>* remove_set;
+    EpochManager* epoch;
+
+private:
+
+    static T* slot(Segment* segment, uint32_t pos) {
+        return std::launder(reinterpret_cast<T*>(segment->slots[pos & (SegmentSize - 1)].data));
+    }
+
+    Segment* allocate_segment() {
+        Segment* segment = pool->allocate();
+        if (segment == nullptr) {
+            try_remove_to_pool();
+            segment = pool->allocate();
+            if (segment == nullptr) return nullptr;
+        }
+        segment->enqueue_pos.store(0, std::memory_order_relaxed);
+        segment->dequeue_pos.store(0, std::memory_order_relaxed);
+        segment->next.store(nullptr, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < SegmentSize; ++i) {
+            segment->slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+        return segment;
+    }
+
+    void try_remove_to_pool() {
+        DeleteNode deletenode;
+        uint64_t min_e = epoch->minepoch();
+        while (remove_set->pop(deletenode)) {
+            if (deletenode.version >= min_e) {
+                remove_set->push(deletenode);
+                break;
+            }
+            else pool->deallocate(deletenode.segment);
+        }
+    }
+
+    template<typename... Args>
+    bool try_enqueue(Segment* segment, Args&&... args) {
+        uint32_t pos;
+        Slot* s;
+        do {
+            pos = segment->enqueue_pos.load(std::memory_order_relaxed);
+            if (pos & closed) return false;
+            s = &segment->slots[pos & (SegmentSize - 1)];
+            int32_t diff = s->seq.load(std::memory_order_acquire) - pos;
+            if (diff < 0 || pos >= max_pos) {
+                segment->enqueue_pos.fetch_or(closed, std::memory_order_acq_rel);
+                return false;
+            }
+            if (diff > 0) continue;
+        } while (segment->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed) == false);
+        try {
+            new (slot(segment, pos)) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            //the slot is claimed, a tombstone lets dequeuers step over it instead of waiting for a value that never comes
+            s->seq.store(pos + 2, std::memory_order_release);
+            throw;
+        }
+        s->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_dequeue(Segment* segment, T& val) {
+        uint32_t pos;
+        Slot* s;
+        while (true) {
+            pos = segment->dequeue_pos.load(std::memory_order_relaxed);
+            s = &segment->slots[pos & (SegmentSize - 1)];
+            int32_t diff = s->seq.load(std::memory_order_acquire) - (pos + 1);
+            if (diff < 0) return false;
+            if (diff == 0 && segment->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            //a tombstone from a throwing enqueue is consumed without a value
+            if (diff == 1 && segment->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                s->seq.store(pos + SegmentSize, std::memory_order_release);
+            }
+        }
+        T* item = slot(segment, pos);
+        val = std::move(*item);
+        item->~T();
+        s->seq.store(pos + SegmentSize, std::memory_order_release);
+        return true;
+    }
+
+public:
+
+    LockFreeQueue() = delete;
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+
+    LockFreeQueue(const LockFreeQueue&&) = delete;
+
+    LockFreeQueue& operator = (const LockFreeQueue&) = delete;
+
+    LockFreeQueue& operator = (const LockFreeQueue&&) = delete;
+
+    //segments sizes the initial segment pool, it grows when a burst needs more
+    explicit LockFreeQueue(uint32_t segments) {
+        assert(segments > 0);
+        pool = new LockFreeMemoryPool<Segment>(segments);
+        remove_set = new LockFreeStack<DeleteNode>(segments);
+        epoch = new EpochManager;
+        Segment* segment = allocate_segment();
+        head.store(segment);
+        tail.store(segment);
+    }
+
+    ~LockFreeQueue() {
+        Segment* segment = head.load(std::memory_order_acquire);
+        while (segment) {
+            uint32_t end = segment->enqueue_pos.load(std::memory_order_acquire) & ~closed;
+            for (uint32_t pos = segment->dequeue_pos.load(std::memory_order_acquire); pos != end; ++pos) {
+                if (segment->slots[pos & (SegmentSize - 1)].seq.load(std::memory_order_acquire) == pos + 1) {
+                    slot(segment, pos)->~T();
+                }
+            }
+            segment = segment->next.load(std::memory_order_acquire);
+        }
+        delete remove_set;
+        delete pool;
+        delete epoch;
+    }
+
+    //only fails when no memory is left for a new tail segment
+    //if T's constructor throws the exception reaches the caller and the claimed slot is skipped by dequeuers
+    template<typename... Args>
+    bool emplace(Args&&... args) {
+        int index = epoch->lockepoch();
+        bool ok = false;
+        while (true) {
+            Segment* segment = tail.load(std::memory_order_acquire);
+            Segment* next = segment->next.load(std::memory_order_acquire);
+            if (next != nullptr) {
+                tail.compare_exchange_strong(segment, next, std::memory_order_acq_rel);
+                continue;
+            }
+            bool enqueued;
+            try {
+                enqueued = try_enqueue(segment, std::forward<Args>(args)...);
+            }
+            catch (...) {
+                epoch->unlockepoch(index);
+                throw;
+            }
+            if (enqueued) {
+                ok = true;
+                break;
+            }
+            Segment* fresh = allocate_segment();
+            if (fresh == nullptr) break;
+            if (segment->next.compare_exchange_strong(next, fresh, std::memory_order_acq_rel)) {
+                tail.compare_exchange_strong(segment, fresh, std::memory_order_acq_rel);
+            }
+            else {
+                pool->deallocate(fresh);
+            }
+        }
+        epoch->unlockepoch(index);
+        return ok;
+    }
+
+    bool enqueue(const T& val) {
+        return emplace(val);
+    }
+
+    bool enqueue(T&& val) {
+        return emplace(std::move(val));
+    }
+
+    bool dequeue(T& val) {
+        int index = epoch->lockepoch();
+        bool ok = false;
+        bool retired = false;
+        while (true) {
+            Segment* segment = head.load(std::memory_order_acquire);
+            if (try_dequeue(segment, val)) {
+                ok = true;
+                break;
+            }
+            //the head segment may only be dropped once it is closed and every claimed slot was consumed
+            uint32_t end = segment->enqueue_pos.load(std::memory_order_acquire);
+            if (!(end & closed)) break;
+            if (segment->dequeue_pos.load(std::memory_order_acquire) != (end & ~closed)) break;
+            Segment* next = segment->next.load(std::memory_order_acquire);
+            if (next == nullptr) break;
+            Segment* cur = segment;
+            tail.compare_exchange_strong(cur, next, std::memory_order_acq_rel);
+            if (head.compare_exchange_strong(segment, next, std::memory_order_acq_rel)) {
+                DeleteNode deletenode = {segment, epoch->get_epoch()};
+                remove_set->push(deletenode);
+                retired = true;
+            }
+        }
+        epoch->unlockepoch(index);
+        if (retired) try_remove_to_pool();
+        return ok;
+    }
+};
\ No newline at end of file
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <sys/uio.h>
+
+//multi producer single consumer ring of variable length byte records
+//every record is an 8 byte header followed by its payload, a record that would straddle the end of the
+//buffer is preceded by a padding record that fills the tail so payloads are always contiguous
+class LockFreeByteRingBuffer {
+
+private:
+
+    static constexpr size_t cache_line = 64;
+    static constexpr uint64_t header_size = 8;
+    static constexpr uint32_t committed = 0x80000000u;
+    static constexpr uint32_t padding = 0x40000000u;
+    static constexpr uint32_t max_length = padding - 1;
+
+    //state is zero until the producer commits, the consumer zeroes headers again when it releases space
+    struct Header {
+        std::atomic<uint32_t> state;
+        uint32_t length;
+    };
+
+    char* buffer;
+    uint64_t capacity;
+
+    alignas(cache_line) std::atomic<uint64_t> write_pos;
+
+    //read_pos is where producers may write up to, peek_pos is consumer private
+    alignas(cache_line) std::atomic<uint64_t> read_pos;
+    uint64_t peek_pos;
+
+private:
+
+    static uint64_t align(uint64_t len) {
+        return (len + header_size - 1) & ~(header_size - 1);
+    }
+
+    Header* header_at(uint64_t offset) {
+        return reinterpret_cast<Header*>(buffer + offset);
+    }
+
+public:
+
+    LockFreeByteRingBuffer() = delete;
+
+    LockFreeByteRingBuffer(const LockFreeByteRingBuffer&) = delete;
+
+    LockFreeByteRingBuffer(const LockFreeByteRingBuffer&&) = delete;
+
+    LockFreeByteRingBuffer& operator = (const LockFreeByteRingBuffer&) = delete;
+
+    LockFreeByteRingBuffer& operator = (const LockFreeByteRingBuffer&&) = delete;
+
+    //SIZE is in bytes and must be pow of 2
+    explicit LockFreeByteRingBuffer(uint64_t SIZE) {
+        assert(__builtin_popcountll(SIZE) == 1 && SIZE >= 2 * header_size);
+        capacity = SIZE;
+        buffer = new (std::nothrow) char[capacity]();
+        if (!buffer) {
+            std::cerr << "Memory allocation failed for lock free byte buffer\n";
+            exit(0);
+        }
+        write_pos = 0;
+        read_pos = 0;
+        peek_pos = 0;
+    }
+
+    ~LockFreeByteRingBuffer() {
+        delete[] buffer;
+    }
+
+    //reserve len contiguous bytes, returns nullptr when there is not enough free space
+    //the returned span belongs to the caller until commit
+    //a record plus its header may take at most half the ring, anything larger could need more than capacity
+    //once the tail padding is counted and would never fit, so it is rejected up front
+    char* reserve(uint32_t len) {
+        if (len > max_length) return nullptr;
+        uint64_t record = header_size + align(len);
+        if (record > capacity / 2) return nullptr;
+        uint64_t pos, offset, need;
+        do {
+            pos = write_pos.load(std::memory_order_relaxed);
+            offset = pos & (capacity - 1);
+            need = record;
+            if (offset + record > capacity) need += capacity - offset;
+            if (pos + need - read_pos.load(std::memory_order_acquire) > capacity) return nullptr;
+        } while (write_pos.compare_exchange_weak(pos, pos + need, std::memory_order_relaxed) == false);
+
+        if (need != record) {
+            Header* pad = header_at(offset);
+            pad->length = capacity - offset - header_size;
+            pad->state.store(committed | padding, std::memory_order_release);
+            offset = 0;
+        }
+        header_at(offset)->length = len;
+        return buffer + offset + header_size;
+    }
+
+    //publish a span returned by reserve
+    void commit(char* data) {
+        Header* header = reinterpret_cast<Header*>(data - header_size);
+        header->state.store(committed, std::memory_order_release);
+    }
+
+    bool write(const void* data, uint32_t len) {
+        char* span = reserve(len);
+        if (span == nullptr) return false;
+        memcpy(span, data, len);
+        commit(span);
+        return true;
+    }
+
+    //consumer only: fill iov with up to max committed payloads following the ones already handed out,
+    //stopping at the first record that is still being written
+    //the spans point into the ring and stay valid until release, so they can go straight to writev
+    //a full ring wraps back onto the first unreleased header, which is still committed, so stop at read_pos + capacity
+    uint32_t read(iovec* iov, uint32_t max) {
+        uint64_t end = read_pos.load(std::memory_order_relaxed) + capacity;
+        uint32_t n = 0;
+        while (n < max && peek_pos != end) {
+            uint64_t offset = peek_pos & (capacity - 1);
+            Header* header = header_at(offset);
+            uint32_t state = header->state.load(std::memory_order_acquire);
+            if (!(state & committed)) break;
+            if (state & padding) {
+                peek_pos += capacity - offset;
+                continue;
+            }
+            iov[n].iov_base = buffer + offset + header_size;
+            iov[n].iov_len = header->length;
+            ++n;
+            peek_pos += header_size + align(header->length);
+        }
+        return n;
+    }
+
+    //consumer only: give every span returned by read back to the producers
+    void release() {
+        uint64_t pos = read_pos.load(std::memory_order_relaxed);
+        if (pos == peek_pos) return;
+        uint64_t begin = pos & (capacity - 1);
+        uint64_t len = peek_pos - pos;
+        assert(len <= capacity);
+        if (begin + len > capacity) {
+            memset(buffer + begin, 0, capacity - begin);
+            memset(buffer, 0, len - (capacity - begin));
+        }
+        else {
+            memset(buffer + begin, 0, len);
+        }
+        read_pos.store(peek_pos, std::memory_order_release);
+    }
+};
\ No newline at end of file
@@ -1,21 +1,314 @@
+#pragma once
+
 #include <iostream>
 #include <atomic>
 #include <cassert>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <thread>
+#include <chrono>
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
 
-template<typename T>
+//MultiProducer/MultiConsumer select the synchronization used on each side:
+//a multi side claims slots with a CAS on its position counter, a single side uses plain stores,
+//and the single producer single consumer ring drops the per slot seq in favor of cached head/tail indices
+//a slot whose T constructor threw is published as a tombstone, seq pos + 2, which no live slot of a ring of 4 or more shows,
+//the consumer meeting it at the head frees it like a dequeue, one in the middle of a bulk run ends that run like an unpublished slot
+template<typename T, bool MultiProducer = true, bool MultiConsumer = true>
 class LockFreeRingBuffer {
 
 private:
 
-    struct Node {
-        T data;
+    static constexpr bool spsc = !MultiProducer && !MultiConsumer;
+    static constexpr size_t cache_line = 64;
+
+    //slots hold raw storage, a T only lives in a slot between its enqueue and its dequeue
+    struct SeqNode {
+        alignas(T) unsigned char data[sizeof(T)];
         std::atomic<uint32_t> seq;
     };
+
+    struct PlainNode {
+        alignas(T) unsigned char data[sizeof(T)];
+    };
+
+    using Node = typename std::conditional<spsc, PlainNode, SeqNode>::type;
+
     Node *buffer;
-    std::atomic<uint32_t> enqueue_pos;
-    std::atomic<uint32_t> dequeue_pos;
     uint32_t size;
 
+    //producer side, cached_dequeue_pos is only used by the spsc ring
+    alignas(cache_line) std::atomic<uint32_t> enqueue_pos;
+    uint32_t cached_dequeue_pos;
+
+    //consumer side, cached_enqueue_pos is only used by the spsc ring
+    alignas(cache_line) std::atomic<uint32_t> dequeue_pos;
+    uint32_t cached_enqueue_pos;
+
+    //parking state for the *_wait calls, the fast path only reads the waiter counts
+    alignas(cache_line) std::atomic<uint32_t> not_empty;
+    std::atomic<uint32_t> consumer_waiters;
+    alignas(cache_line) std::atomic<uint32_t> not_full;
+    std::atomic<uint32_t> producer_waiters;
+    std::atomic<uint32_t> spin_limit;
+    //private expedited membarrier is available, a parking thread then fences every running thread for notify
+    bool asymmetric;
+
+    static constexpr uint32_t min_spin = 16;
+    static constexpr uint32_t max_spin = 4096;
+    static constexpr uint32_t yield_count = 8;
+
+private:
+
+    T* slot(uint32_t pos) {
+        return std::launder(reinterpret_cast<T*>(buffer[pos & (size - 1)].data));
+    }
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    static void futex_wait(std::atomic<uint32_t>* addr, uint32_t val, const timespec* timeout) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, val, timeout, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t>* addr, uint32_t count) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, count > INT_MAX ? INT_MAX : count, nullptr, nullptr, 0);
+    }
+
+    //the store-load ordering between a publish and the waiter count is paid by the side that parks:
+    //with membarrier notify only keeps the compiler from reordering, without it both sides fence
+    void light_barrier() {
+        if (asymmetric) std::atomic_signal_fence(std::memory_order_seq_cst);
+        else std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void heavy_barrier() {
+        if (asymmetric) syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        else std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    //pairs with the waiter's heavy barrier, either we see the waiter or it sees our publish
+    void notify(std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiters, uint32_t count) {
+        light_barrier();
+        if (waiters.load(std::memory_order_relaxed) == 0) return;
+        word.fetch_add(1, std::memory_order_release);
+        futex_wake(&word, count);
+    }
+
+    //spin, then yield, then park on word until op succeeds or the deadline passes
+    template<typename Op>
+    bool wait(Op op, std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiters, const std::chrono::steady_clock::time_point* deadline) {
+        uint32_t limit = spin_limit.load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < limit; ++i) {
+            if (op()) {
+                if (limit < max_spin) spin_limit.store(limit * 2, std::memory_order_relaxed);
+                return true;
+            }
+            cpu_relax();
+        }
+        for (uint32_t i = 0; i < yield_count; ++i) {
+            std::this_thread::yield();
+            if (op()) return true;
+        }
+        if (limit > min_spin) spin_limit.store(limit / 2, std::memory_order_relaxed);
+
+        while (true) {
+            timespec ts;
+            timespec* timeout = nullptr;
+            if (deadline) {
+                auto now = std::chrono::steady_clock::now();
+                if (now >= *deadline) return op();
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(*deadline - now).count();
+                ts.tv_sec = ns / 1000000000;
+                ts.tv_nsec = ns % 1000000000;
+                timeout = &ts;
+            }
+            waiters.fetch_add(1, std::memory_order_seq_cst);
+            heavy_barrier();
+            uint32_t val = word.load(std::memory_order_acquire);
+            if (op()) {
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            futex_wait(&word, val, timeout);
+            waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (op()) return true;
+        }
+    }
+
+    //claim between min and max consecutive free slots, returns the number claimed
+    uint32_t claim_enqueue(uint32_t& pos, uint32_t min, uint32_t max) {
+        uint32_t count;
+        if constexpr (spsc) {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+            count = size - (pos - cached_dequeue_pos);
+            if (count < max) {
+                cached_dequeue_pos = dequeue_pos.load(std::memory_order_acquire);
+                count = size - (pos - cached_dequeue_pos);
+            }
+            if (count < min) return 0;
+            return count < max ? count : max;
+        }
+        else if constexpr (!MultiProducer) {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+            count = 0;
+            while (count < max && buffer[(pos + count) & (size - 1)].seq.load(std::memory_order_acquire) == pos + count) {
+                ++count;
+            }
+            if (count < min) return 0;
+            enqueue_pos.store(pos + count, std::memory_order_relaxed);
+            return count;
+        }
+        else {
+            do {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+                int32_t diff = buffer[pos & (size - 1)].seq.load(std::memory_order_acquire) - pos;
+                if (diff < 0) return 0;
+                if (diff > 0) continue;
+                count = 1;
+                while (count < max && buffer[(pos + count) & (size - 1)].seq.load(std::memory_order_acquire) == pos + count) {
+                    ++count;
+                }
+                if (count < min) {
+                    if (enqueue_pos.load(std::memory_order_relaxed) == pos) return 0;
+                    continue;
+                }
+                if (enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+            } while (true);
+            return count;
+        }
+    }
+
+    void publish_enqueue(uint32_t pos, uint32_t count) {
+        if constexpr (spsc) {
+            enqueue_pos.store(pos + count, std::memory_order_release);
+        }
+        else {
+            for (uint32_t i = 0; i < count; ++i) {
+                buffer[(pos + i) & (size - 1)].seq.store(pos + i + 1, std::memory_order_release);
+            }
+        }
+    }
+
+    uint32_t claim_dequeue(uint32_t& pos, uint32_t min, uint32_t max) {
+        uint32_t count;
+        if constexpr (spsc) {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+            count = cached_enqueue_pos - pos;
+            if (count < max) {
+                cached_enqueue_pos = enqueue_pos.load(std::memory_order_acquire);
+                count = cached_enqueue_pos - pos;
+            }
+            if (count < min) return 0;
+            return count < max ? count : max;
+        }
+        else if constexpr (!MultiConsumer) {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+            uint32_t head = pos;
+            while (buffer[pos & (size - 1)].seq.load(std::memory_order_acquire) == pos + 2) {
+                publish_dequeue(pos, 1);
+                ++pos;
+            }
+            if (pos != head) dequeue_pos.store(pos, std::memory_order_relaxed);
+            count = 0;
+            while (count < max && buffer[(pos + count) & (size - 1)].seq.load(std::memory_order_acquire) == pos + count + 1) {
+                ++count;
+            }
+            if (count < min) return 0;
+            dequeue_pos.store(pos + count, std::memory_order_relaxed);
+            return count;
+        }
+        else {
+            do {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+                uint32_t seq = buffer[pos & (size - 1)].seq.load(std::memory_order_acquire);
+                int32_t diff = seq - (pos + 1);
+                if (diff < 0) return 0;
+                if (diff > 0) {
+                    //only a tombstone shows pos + 2, whoever moves dequeue_pos past it frees the slot
+                    if (seq == pos + 2 && dequeue_pos.compare_exchange_strong(pos, pos + 1, std::memory_order_relaxed)) publish_dequeue(pos, 1);
+                    continue;
+                }
+                count = 1;
+                while (count < max && buffer[(pos + count) & (size - 1)].seq.load(std::memory_order_acquire) == pos + count + 1) {
+                    ++count;
+                }
+                if (count < min) {
+                    if (dequeue_pos.load(std::memory_order_relaxed) == pos) return 0;
+                    continue;
+                }
+                if (dequeue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+            } while (true);
+            return count;
+        }
+    }
+
+    //slots claimed for values whose constructor threw, the spsc ring never moved enqueue_pos for them
+    void publish_tombstone(uint32_t pos, uint32_t count) {
+        if constexpr (!spsc) {
+            for (uint32_t i = 0; i < count; ++i) {
+                buffer[(pos + i) & (size - 1)].seq.store(pos + i + 2, std::memory_order_release);
+            }
+        }
+    }
+
+    void publish_dequeue(uint32_t pos, uint32_t count) {
+        if constexpr (spsc) {
+            dequeue_pos.store(pos + count, std::memory_order_release);
+        }
+        else {
+            for (uint32_t i = 0; i < count; ++i) {
+                buffer[(pos + i) & (size - 1)].seq.store(pos + i + size, std::memory_order_release);
+            }
+        }
+    }
+
+    uint32_t bulk_enqueue(const T* vals, uint32_t min, uint32_t max) {
+        if (max > size) max = size;
+        if (min > max || max == 0) return 0;
+        uint32_t pos;
+        uint32_t count = claim_enqueue(pos, min, max);
+        uint32_t i = 0;
+        try {
+            for (; i < count; ++i) {
+                new (slot(pos + i)) T(vals[i]);
+            }
+        }
+        catch (...) {
+            publish_enqueue(pos, i);
+            publish_tombstone(pos + i, count - i);
+            if (i) notify(not_empty, consumer_waiters, i);
+            throw;
+        }
+        publish_enqueue(pos, count);
+        if (count) notify(not_empty, consumer_waiters, count);
+        return count;
+    }
+
+    uint32_t bulk_dequeue(T* vals, uint32_t min, uint32_t max) {
+        if (max > size) max = size;
+        if (min > max || max == 0) return 0;
+        uint32_t pos;
+        uint32_t count = claim_dequeue(pos, min, max);
+        for (uint32_t i = 0; i < count; ++i) {
+            T* item = slot(pos + i);
+            vals[i] = std::move(*item);
+            item->~T();
+        }
+        publish_dequeue(pos, count);
+        if (count) notify(not_full, producer_waiters, count);
+        return count;
+    }
+
 public:
     LockFreeRingBuffer() = delete;
 
@@ -27,9 +320,9 @@ public:
     
     LockFreeRingBuffer& operator = (const LockFreeRingBuffer&&) = delete;
 
-    //SIZE must be pow of 2
+    //SIZE must be pow of 2, and at least 4 unless the ring is spsc so tombstones stay apart from the next lap's seq
     explicit LockFreeRingBuffer(uint32_t SIZE) {
-        assert(__builtin_popcount(SIZE) == 1);
+        assert(__builtin_popcount(SIZE) == 1 && (spsc || SIZE >= 4));
         size = SIZE;
         buffer = new (std::nothrow) Node[size];
         if (!buffer) {
@@ -38,44 +331,146 @@ public:
         }
         enqueue_pos = 0;
         dequeue_pos = 0;
-        for (int i = 0; i < size; ++i) {
-            buffer[i].seq = i;
+        cached_enqueue_pos = 0;
+        cached_dequeue_pos = 0;
+        not_empty = 0;
+        consumer_waiters = 0;
+        not_full = 0;
+        producer_waiters = 0;
+        spin_limit = min_spin;
+        asymmetric = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+        if constexpr (!spsc) {
+            for (uint32_t i = 0; i < size; ++i) {
+                buffer[i].seq = i;
+            }
         }
     }
 
+    //values still queued are destroyed, slots reserved but never committed are left alone
     ~LockFreeRingBuffer() {
+        uint32_t end = enqueue_pos.load(std::memory_order_acquire);
+        for (uint32_t pos = dequeue_pos.load(std::memory_order_acquire); pos != end; ++pos) {
+            if constexpr (!spsc) {
+                if (buffer[pos & (size - 1)].seq.load(std::memory_order_acquire) != pos + 1) continue;
+            }
+            slot(pos)->~T();
+        }
         delete[] buffer;
     }
 
-    bool enqueue(const T& val) {
-        Node *node;
+    template<typename... Args>
+    bool emplace(Args&&... args) {
         uint32_t pos;
-        do {
-            pos = enqueue_pos.load(std::memory_order_relaxed);
-            node = &buffer[pos & (size - 1)];
-            uint32_t seq = node->seq.load(std::memory_order_acquire);
-            if (seq + size == pos + 1) {
-                return false;
-            }
-        } while (enqueue_pos.compare_exchange_strong(pos, pos + 1, std::memory_order_relaxed) == false);
-        node->data = val;
-        node->seq.store(pos + 1, std::memory_order_release);
+        if (claim_enqueue(pos, 1, 1) == 0) return false;
+        try {
+            new (slot(pos)) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            publish_tombstone(pos, 1);
+            throw;
+        }
+        commit(pos);
         return true;
     }
+
+    bool enqueue(const T& val) {
+        return emplace(val);
+    }
+
+    //val is only moved from when the enqueue succeeds
+    bool enqueue(T&& val) {
+        return emplace(std::move(val));
+    }
     
     bool dequeue(T &val) {
-        Node *node;
         uint32_t pos;
-        do {
-            pos = dequeue_pos.load(std::memory_order_relaxed);
-            node = &buffer[pos & (size - 1)];
-            uint32_t seq = node->seq.load(std::memory_order_acquire);
-            if (seq == pos) {
-                return false;
-            }
-        } while (dequeue_pos.compare_exchange_strong(pos, pos + 1, std::memory_order_relaxed) == false);
-        val = node->data;
-        node->seq.store(pos + size, std::memory_order_release);
+        T* item = peek(pos);
+        if (item == nullptr) return false;
+        val = std::move(*item);
+        release(pos);
         return true;
     }
-};
\ No newline at end of file
+
+    //zero copy producer side: reserve a slot, construct a T in the returned storage, then commit it
+    //a spsc producer must commit before reserving again
+    T* reserve(uint32_t& pos) {
+        if (claim_enqueue(pos, 1, 1) == 0) return nullptr;
+        return slot(pos);
+    }
+
+    void commit(uint32_t pos) {
+        publish_enqueue(pos, 1);
+        notify(not_empty, consumer_waiters, 1);
+    }
+
+    //zero copy consumer side: claim the oldest value and use it in place, then release the slot
+    T* peek(uint32_t& pos) {
+        if (claim_dequeue(pos, 1, 1) == 0) return nullptr;
+        return slot(pos);
+    }
+
+    void release(uint32_t pos) {
+        slot(pos)->~T();
+        publish_dequeue(pos, 1);
+        notify(not_full, producer_waiters, 1);
+    }
+
+    //block until there is room for val
+    void enqueue_wait(const T& val) {
+        wait([&] { return enqueue(val); }, not_full, producer_waiters, nullptr);
+    }
+
+    void enqueue_wait(T&& val) {
+        wait([&] { return enqueue(std::move(val)); }, not_full, producer_waiters, nullptr);
+    }
+
+    //block until a value is available
+    void dequeue_wait(T& val) {
+        wait([&] { return dequeue(val); }, not_empty, consumer_waiters, nullptr);
+    }
+
+    template<typename Rep, typename Period>
+    bool enqueue_for(const T& val, const std::chrono::duration<Rep, Period>& timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait([&] { return enqueue(val); }, not_full, producer_waiters, &deadline);
+    }
+
+    template<typename Rep, typename Period>
+    bool enqueue_for(T&& val, const std::chrono::duration<Rep, Period>& timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait([&] { return enqueue(std::move(val)); }, not_full, producer_waiters, &deadline);
+    }
+
+    template<typename Rep, typename Period>
+    bool dequeue_for(T& val, const std::chrono::duration<Rep, Period>& timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait([&] { return dequeue(val); }, not_empty, consumer_waiters, &deadline);
+    }
+
+    //all or nothing: either n values are enqueued or none
+    bool enqueue_bulk(const T* vals, uint32_t n) {
+        return bulk_enqueue(vals, n, n) == n;
+    }
+
+    //best effort: enqueue up to n values, returns the number enqueued
+    uint32_t enqueue_some(const T* vals, uint32_t n) {
+        return bulk_enqueue(vals, 1, n);
+    }
+
+    bool dequeue_bulk(T* vals, uint32_t n) {
+        return bulk_dequeue(vals, n, n) == n;
+    }
+
+    uint32_t dequeue_some(T* vals, uint32_t n) {
+        return bulk_dequeue(vals, 1, n);
+    }
+};
+
+template<typename T>
+using LockFreeSPSCRingBuffer = LockFreeRingBuffer<T, false, false>;
+
+template<typename T>
+using LockFreeMPSCRingBuffer = LockFreeRingBuffer<T, true, false>;
+
+template<typename T>
+using LockFreeSPMCRingBuffer = LockFreeRingBuffer<T, false, true>;
\ No newline at end of file
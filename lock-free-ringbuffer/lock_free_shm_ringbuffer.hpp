@@ -0,0 +1,258 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//MPMC ring whose positions and slots live in a shm_open/mmap region so separate processes can share it
+//the region holds no pointers, every process addresses it from its own mapping
+template<typename T>
+class LockFreeShmRingBuffer {
+
+    static_assert(std::is_trivially_copyable<T>::value, "shared memory messages must be trivially copyable");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory positions must be lock free");
+
+private:
+
+    static constexpr size_t cache_line = 64;
+    static constexpr uint64_t layout_magic = 0x4c46534852494e47ull;
+    static constexpr uint32_t layout_version = 1;
+
+    struct Node {
+        T data;
+        std::atomic<uint32_t> seq;
+    };
+
+    //magic is written last by the creator, attach only trusts a region once it is visible
+    struct Header {
+        std::atomic<uint64_t> magic;
+        uint32_t version;
+        uint32_t size;
+        uint32_t node_size;
+        uint32_t node_align;
+        uint64_t length;
+        alignas(cache_line) std::atomic<uint32_t> enqueue_pos;
+        alignas(cache_line) std::atomic<uint32_t> dequeue_pos;
+    };
+
+    static constexpr size_t nodes_offset = (sizeof(Header) + alignof(Node) + cache_line - 1) / cache_line * cache_line;
+
+    void* base;
+    uint64_t length;
+    Header* header;
+    Node* buffer;
+    uint32_t size;
+
+private:
+
+    LockFreeShmRingBuffer(void* _base, uint64_t _length) {
+        base = _base;
+        length = _length;
+        header = reinterpret_cast<Header*>(base);
+        buffer = reinterpret_cast<Node*>(reinterpret_cast<char*>(base) + nodes_offset);
+        size = header->size;
+    }
+
+    static uint64_t region_length(uint32_t size) {
+        return nodes_offset + uint64_t(size) * sizeof(Node);
+    }
+
+    uint32_t claim_enqueue(uint32_t& pos, uint32_t min, uint32_t max) {
+        uint32_t count;
+        do {
+            pos = header->enqueue_pos.load(std::memory_order_relaxed);
+            int32_t diff = buffer[pos & (size - 1)].seq.load(std::memory_order_acquire) - pos;
+            if (diff < 0) return 0;
+            if (diff > 0) continue;
+            count = 1;
+            while (count < max && buffer[(pos + count) & (size - 1)].seq.load(std::memory_order_acquire) == pos + count) {
+                ++count;
+            }
+            if (count < min) {
+                if (header->enqueue_pos.load(std::memory_order_relaxed) == pos) return 0;
+                continue;
+            }
+            if (header->enqueue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+        } while (true);
+        return count;
+    }
+
+    uint32_t claim_dequeue(uint32_t& pos, uint32_t min, uint32_t max) {
+        uint32_t count;
+        do {
+            pos = header->dequeue_pos.load(std::memory_order_relaxed);
+            int32_t diff = buffer[pos & (size - 1)].seq.load(std::memory_order_acquire) - (pos + 1);
+            if (diff < 0) return 0;
+            if (diff > 0) continue;
+            count = 1;
+            while (count < max && buffer[(pos + count) & (size - 1)].seq.load(std::memory_order_acquire) == pos + count + 1) {
+                ++count;
+            }
+            if (count < min) {
+                if (header->dequeue_pos.load(std::memory_order_relaxed) == pos) return 0;
+                continue;
+            }
+            if (header->dequeue_pos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) break;
+        } while (true);
+        return count;
+    }
+
+    uint32_t bulk_enqueue(const T* vals, uint32_t min, uint32_t max) {
+        if (max > size) max = size;
+        if (min > max || max == 0) return 0;
+        uint32_t pos;
+        uint32_t count = claim_enqueue(pos, min, max);
+        for (uint32_t i = 0; i < count; ++i) {
+            Node* node = &buffer[(pos + i) & (size - 1)];
+            memcpy(&node->data, &vals[i], sizeof(T));
+            node->seq.store(pos + i + 1, std::memory_order_release);
+        }
+        return count;
+    }
+
+    uint32_t bulk_dequeue(T* vals, uint32_t min, uint32_t max) {
+        if (max > size) max = size;
+        if (min > max || max == 0) return 0;
+        uint32_t pos;
+        uint32_t count = claim_dequeue(pos, min, max);
+        for (uint32_t i = 0; i < count; ++i) {
+            Node* node = &buffer[(pos + i) & (size - 1)];
+            memcpy(&vals[i], &node->data, sizeof(T));
+            node->seq.store(pos + i + size, std::memory_order_release);
+        }
+        return count;
+    }
+
+public:
+
+    LockFreeShmRingBuffer() = delete;
+
+    LockFreeShmRingBuffer(const LockFreeShmRingBuffer&) = delete;
+
+    LockFreeShmRingBuffer(const LockFreeShmRingBuffer&&) = delete;
+
+    LockFreeShmRingBuffer& operator = (const LockFreeShmRingBuffer&) = delete;
+
+    LockFreeShmRingBuffer& operator = (const LockFreeShmRingBuffer&&) = delete;
+
+    //only unmaps this process's view, the segment itself lives until unlink
+    ~LockFreeShmRingBuffer() {
+        munmap(base, length);
+    }
+
+    //SIZE must be pow of 2, fails if a segment with this name already exists
+    static LockFreeShmRingBuffer* create(const char* name, uint32_t SIZE) {
+        assert(__builtin_popcount(SIZE) == 1);
+        uint64_t len = region_length(SIZE);
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            std::cerr << "shm_open failed for lock free shm buffer\n";
+            return nullptr;
+        }
+        if (ftruncate(fd, len) != 0) {
+            std::cerr << "ftruncate failed for lock free shm buffer\n";
+            close(fd);
+            shm_unlink(name);
+            return nullptr;
+        }
+        void* addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "mmap failed for lock free shm buffer\n";
+            shm_unlink(name);
+            return nullptr;
+        }
+
+        Header* header = new (addr) Header;
+        header->version = layout_version;
+        header->size = SIZE;
+        header->node_size = sizeof(Node);
+        header->node_align = alignof(Node);
+        header->length = len;
+        header->enqueue_pos.store(0, std::memory_order_relaxed);
+        header->dequeue_pos.store(0, std::memory_order_relaxed);
+        Node* nodes = reinterpret_cast<Node*>(reinterpret_cast<char*>(addr) + nodes_offset);
+        for (uint32_t i = 0; i < SIZE; ++i) {
+            new (&nodes[i].seq) std::atomic<uint32_t>(i);
+        }
+        header->magic.store(layout_magic, std::memory_order_release);
+        return new LockFreeShmRingBuffer(addr, len);
+    }
+
+    //fails if the segment is missing, still being created, or laid out for a different T or version
+    static LockFreeShmRingBuffer* attach(const char* name) {
+        int fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0) {
+            std::cerr << "shm_open failed for lock free shm buffer\n";
+            return nullptr;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || uint64_t(st.st_size) < sizeof(Header)) {
+            std::cerr << "lock free shm buffer is not initialized\n";
+            close(fd);
+            return nullptr;
+        }
+        uint64_t len = st.st_size;
+        void* addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "mmap failed for lock free shm buffer\n";
+            return nullptr;
+        }
+
+        Header* header = reinterpret_cast<Header*>(addr);
+        if (header->magic.load(std::memory_order_acquire) != layout_magic
+            || header->version != layout_version
+            || header->node_size != sizeof(Node)
+            || header->node_align != alignof(Node)
+            || __builtin_popcount(header->size) != 1
+            || header->length != len
+            || region_length(header->size) != len) {
+            std::cerr << "lock free shm buffer layout mismatch\n";
+            munmap(addr, len);
+            return nullptr;
+        }
+        return new LockFreeShmRingBuffer(addr, len);
+    }
+
+    static bool unlink(const char* name) {
+        return shm_unlink(name) == 0;
+    }
+
+    uint32_t capacity() const {
+        return size;
+    }
+
+    bool enqueue(const T& val) {
+        return bulk_enqueue(&val, 1, 1) == 1;
+    }
+
+    bool dequeue(T& val) {
+        return bulk_dequeue(&val, 1, 1) == 1;
+    }
+
+    //all or nothing: either n values are enqueued or none
+    bool enqueue_bulk(const T* vals, uint32_t n) {
+        return bulk_enqueue(vals, n, n) == n;
+    }
+
+    //best effort: enqueue up to n values, returns the number enqueued
+    uint32_t enqueue_some(const T* vals, uint32_t n) {
+        return bulk_enqueue(vals, 1, n);
+    }
+
+    bool dequeue_bulk(T* vals, uint32_t n) {
+        return bulk_dequeue(vals, n, n) == n;
+    }
+
+    uint32_t dequeue_some(T* vals, uint32_t n) {
+        return bulk_dequeue(vals, 1, n);
+    }
+};
\ No newline at end of file
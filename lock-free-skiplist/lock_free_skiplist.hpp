@@ -0,0 +1,420 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <optional>
+#include <utility>
+#include <tuple>
+#include <type_traits>
+
+#include "../lock-free-epoch/lock_free_epoch_reclaimer.hpp"
+#include "../lock-free-common/lock_free_value_cell.hpp"
+
+//ordered map on a lock free skip list (Fraser, Herlihy & Shavit), keys need a <
+//level 0 is a Michael list and decides membership, the upper levels only speed up the search
+//a node is removed by marking bit 0 of its next pointers top down, the mark on level 0 is the removal,
+//traversals that modify the list unlink marked nodes as they pass them, lookups and scans just step over them
+//an inserter may still be linking upper levels when its node gets removed, so the node is retired by whichever
+//of the inserter and the remover finishes last, after both made sure it is unlinked on every level
+//level 0 lives in the node, the levels above it in a tower sized to the node's height class (2, 4, 8 or 16 levels),
+//a node keeps its tower while it sits in the pool and swaps it when it is reused for another class
+template<typename K, typename V>
+class LockFreeSkipList {
+
+public:
+
+    //levels are drawn with p = 1/4, 16 of them cover about 4^16 keys
+    static constexpr int max_level = 16;
+
+    struct alignas(8) Node {
+        K key;
+        LockFreeValueCell<V> value;
+        //one for the inserter, one for the remover
+        std::atomic<uint32_t> refs;
+        int height;
+        //class of upper, -1 when the node has no tower
+        int tower = -1;
+        //levels 1 to height - 1
+        std::atomic<Node*>* upper = nullptr;
+        std::atomic<Node*> bottom;
+
+        std::atomic<Node*>& next(int level) {
+            return level == 0 ? bottom : upper[level - 1];
+        }
+    };
+
+private:
+
+    //tower class c holds the levels above 0 of a node up to 2 << c levels high
+    static constexpr int tower_classes = 4;
+
+    template<int Levels>
+    struct Tower {
+        std::atomic<Node*> links[Levels];
+    };
+
+    template<int C>
+    using TowerPool = LockFreeMemoryPool<Tower<(2 << C) - 1>>;
+
+    LockFreeMemoryPool<Node>* pool;
+    EpochReclaimer<Node>* reclaimer;
+    //towers only go back to their pool when their node is reused, which the reclaimer already made safe
+    std::tuple<TowerPool<0>*, TowerPool<1>*, TowerPool<2>*, TowerPool<3>*> towers;
+
+    //head is never compared, it sorts before every key
+    Node head;
+    std::atomic<Node*> head_links[max_level - 1];
+    //highest level in use, searches start there instead of at max_level
+    std::atomic<int> top;
+    std::atomic<uint64_t> element_count;
+
+private:
+
+    static bool is_remove(Node* next) {
+        return reinterpret_cast<uint64_t>(next) & 1;
+    }
+
+    static Node* unmark(Node* next) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) & ~uint64_t(1));
+    }
+
+    static Node* mark(Node* next) {
+        return reinterpret_cast<Node*>(reinterpret_cast<uint64_t>(next) | 1);
+    }
+
+    static bool equal(const K& a, const K& b) {
+        return !(a < b) && !(b < a);
+    }
+
+    static int random_height() {
+        static thread_local uint64_t seed = reinterpret_cast<uint64_t>(&seed) | 1;
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        int height = 1 + __builtin_ctzll(seed | (1ull << 62)) / 2;
+        return height < max_level ? height : max_level;
+    }
+
+    //preds[l] is the last node before key on level l and succs[l] the one after it, marked nodes on the way are unlinked
+    //true when succs[0] holds key
+    bool find(const K& key, Node** preds, Node** succs) {
+        while (true) {
+            bool restart = false;
+            Node* pred = &head;
+            int levels = top.load(std::memory_order_acquire);
+            for (int level = max_level - 1; level >= levels; --level) {
+                preds[level] = &head;
+                succs[level] = nullptr;
+            }
+            for (int level = levels - 1; level >= 0; --level) {
+                Node* cur = unmark(pred->next(level).load(std::memory_order_acquire));
+                while (cur) {
+                    Node* next = cur->next(level).load(std::memory_order_acquire);
+                    if (is_remove(next)) {
+                        Node* expected = cur;
+                        if (!pred->next(level).compare_exchange_strong(expected, unmark(next), std::memory_order_acq_rel)) {
+                            restart = true;
+                            break;
+                        }
+                        cur = unmark(next);
+                        continue;
+                    }
+                    if (!(cur->key < key)) break;
+                    pred = cur;
+                    cur = next;
+                }
+                if (restart) break;
+                preds[level] = pred;
+                succs[level] = cur;
+            }
+            if (!restart) return succs[0] && equal(succs[0]->key, key);
+        }
+    }
+
+    //first node on level 0 not ordered before key that was not removed when passed, nothing is unlinked
+    //must run inside an epoch
+    Node* search(const K& key) {
+        Node* pred = &head;
+        Node* cur = nullptr;
+        for (int level = top.load(std::memory_order_acquire) - 1; level >= 0; --level) {
+            cur = unmark(pred->next(level).load(std::memory_order_acquire));
+            while (cur) {
+                Node* next = cur->next(level).load(std::memory_order_acquire);
+                if (is_remove(next)) {
+                    cur = unmark(next);
+                    continue;
+                }
+                if (!(cur->key < key)) break;
+                pred = cur;
+                cur = next;
+            }
+        }
+        return cur;
+    }
+
+    //next node on level 0 that was not removed when passed
+    static Node* next_live(Node* node) {
+        Node* cur = unmark(node->next(0).load(std::memory_order_acquire));
+        while (cur && is_remove(cur->next(0).load(std::memory_order_acquire))) {
+            cur = unmark(cur->next(0).load(std::memory_order_acquire));
+        }
+        return cur;
+    }
+
+    //the inserter and the remover each drop one reference once the node can no longer be linked by them
+    void release(Node* node) {
+        if (node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) reclaimer->retire(node);
+    }
+
+    static int tower_class(int height) {
+        return height == 1 ? -1 : 31 - __builtin_clz(uint32_t(height - 1));
+    }
+
+    template<int C>
+    std::atomic<Node*>* take_tower() {
+        auto* tower = std::get<C>(towers)->allocate();
+        if (tower == nullptr) {
+            std::cerr << "Pool size is too small\n";
+            exit(0);
+        }
+        return tower->links;
+    }
+
+    template<int C>
+    void give_tower(std::atomic<Node*>* links) {
+        std::get<C>(towers)->deallocate(reinterpret_cast<Tower<(2 << C) - 1>*>(links));
+    }
+
+    //gives node a tower of the class height needs, keeping the one it has when it already fits
+    void fit_tower(Node* node, int height) {
+        int c = tower_class(height);
+        if (c == node->tower) return;
+        switch (node->tower) {
+            case 0: give_tower<0>(node->upper); break;
+            case 1: give_tower<1>(node->upper); break;
+            case 2: give_tower<2>(node->upper); break;
+            case 3: give_tower<3>(node->upper); break;
+            default: break;
+        }
+        switch (c) {
+            case 0: node->upper = take_tower<0>(); break;
+            case 1: node->upper = take_tower<1>(); break;
+            case 2: node->upper = take_tower<2>(); break;
+            case 3: node->upper = take_tower<3>(); break;
+            default: node->upper = nullptr; break;
+        }
+        node->tower = c;
+    }
+
+    Node* new_node(const K& key, const V& value, int height) {
+        Node* node = pool->allocate();
+        if (node == nullptr) {
+            std::cerr << "Pool size is too small\n";
+            exit(0);
+        }
+        node->key = key;
+        node->value.init(value);
+        node->refs.store(2, std::memory_order_relaxed);
+        node->height = height;
+        fit_tower(node, height);
+        return node;
+    }
+
+public:
+
+    LockFreeSkipList() = delete;
+
+    LockFreeSkipList(const LockFreeSkipList&) = delete;
+
+    LockFreeSkipList(const LockFreeSkipList&&) = delete;
+
+    LockFreeSkipList& operator = (const LockFreeSkipList&) = delete;
+
+    LockFreeSkipList& operator = (const LockFreeSkipList&&) = delete;
+
+    //size is the initial node count of the pool, which grows on demand, magazine_size as in LockFreeMemoryPool
+    explicit LockFreeSkipList(uint32_t size, uint32_t magazine_size = 0) {
+        assert(size > 0);
+        head.upper = head_links;
+        for (int level = 0; level < max_level; ++level) {
+            head.next(level).store(nullptr, std::memory_order_relaxed);
+        }
+        head.height = max_level;
+        top.store(1, std::memory_order_relaxed);
+        element_count.store(0, std::memory_order_relaxed);
+        pool = new LockFreeMemoryPool<Node>(size, magazine_size);
+        reclaimer = new EpochReclaimer<Node>(pool);
+        //with p = 1/4 about a quarter of the nodes need a tower and each class is a quarter of the one below
+        std::get<0>(towers) = new TowerPool<0>(size / 4 + 1, magazine_size);
+        std::get<1>(towers) = new TowerPool<1>(size / 64 + 1, magazine_size);
+        std::get<2>(towers) = new TowerPool<2>(size / 4096 + 1, magazine_size);
+        std::get<3>(towers) = new TowerPool<3>(size / 65536 + 1, magazine_size);
+    }
+
+    //nodes still on level 0 go back to the pool, the retired ones go with the reclaimer
+    ~LockFreeSkipList() {
+        Node* node = unmark(head.next(0).load(std::memory_order_acquire));
+        while (node) {
+            Node* next = unmark(node->next(0).load(std::memory_order_acquire));
+            pool->deallocate(node);
+            node = next;
+        }
+        delete reclaimer;
+        delete pool;
+        delete std::get<0>(towers);
+        delete std::get<1>(towers);
+        delete std::get<2>(towers);
+        delete std::get<3>(towers);
+    }
+
+    //true when the key was new, an existing key gets its value replaced
+    bool insert(const K& key, const V& value) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
+
+        Node* preds[max_level];
+        Node* succs[max_level];
+        Node* node = nullptr;
+        int height = random_height();
+        while (true) {
+            if (find(key, preds, succs)) {
+                succs[0]->value.store(value);
+                if (node) pool->deallocate(node);
+                reclaimer->leave(index);
+                return false;
+            }
+            if (node == nullptr) node = new_node(key, value, height);
+            for (int level = 0; level < height; ++level) {
+                node->next(level).store(succs[level], std::memory_order_relaxed);
+            }
+            int levels = top.load(std::memory_order_relaxed);
+            while (levels < height && !top.compare_exchange_weak(levels, height, std::memory_order_acq_rel)) {}
+            Node* expected = succs[0];
+            if (preds[0]->next(0).compare_exchange_strong(expected, node, std::memory_order_acq_rel)) break;
+        }
+        element_count.fetch_add(1, std::memory_order_relaxed);
+
+        //the upper levels are linked bottom up, a remover marking them stops the inserter
+        for (int level = 1; level < height; ++level) {
+            bool linked = false;
+            while (true) {
+                Node* succ = succs[level];
+                Node* next = node->next(level).load(std::memory_order_acquire);
+                if (is_remove(next)) break;
+                if (next != succ && !node->next(level).compare_exchange_strong(next, succ, std::memory_order_acq_rel)) break;
+                Node* expected = succ;
+                if (preds[level]->next(level).compare_exchange_strong(expected, node, std::memory_order_acq_rel)) {
+                    linked = true;
+                    break;
+                }
+                find(key, preds, succs);
+                if (succs[0] != node) break;
+            }
+            if (!linked) break;
+        }
+        //pairs with the fence in remove: either the remover sees every level linked here or this sees its mark
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (is_remove(node->next(0).load(std::memory_order_acquire))) find(key, preds, succs);
+        release(node);
+
+        reclaimer->leave(index);
+        return true;
+    }
+
+    std::optional<V> find(const K& key) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
+
+        std::optional<V> value;
+        Node* node = search(key);
+        V copy;
+        if (node && equal(node->key, key) && node->value.load(copy)) value = copy;
+
+        reclaimer->leave(index);
+        return value;
+    }
+
+    bool contains(const K& key) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
+
+        Node* node = search(key);
+        bool found = node && equal(node->key, key);
+
+        reclaimer->leave(index);
+        return found;
+    }
+
+    //the first entry whose key is not ordered before key
+    std::optional<std::pair<K, V>> lower_bound(const K& key) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
+
+        std::optional<std::pair<K, V>> entry;
+        Node* node = search(key);
+        V copy;
+        if (node && node->value.load(copy)) entry.emplace(node->key, copy);
+
+        reclaimer->leave(index);
+        return entry;
+    }
+
+    //fn(const K&, const V&) on every entry in [from, to) in key order, returns how many were visited
+    //the scan is weakly consistent: keys present for the whole scan are visited once, concurrent inserts and removes may or may not be
+    //the whole scan runs in one epoch, so a long scan holds back reclamation
+    template<typename Fn>
+    uint64_t range(const K& from, const K& to, Fn&& fn) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
+
+        uint64_t visited = 0;
+        V value;
+        for (Node* node = search(from); node && node->key < to; node = next_live(node)) {
+            if (!node->value.load(value)) continue;
+            fn(static_cast<const K&>(node->key), static_cast<const V&>(value));
+            ++visited;
+        }
+
+        reclaimer->leave(index);
+        return visited;
+    }
+
+    //true when this call removed the key
+    bool remove(const K& key) {
+        reclaimer->collect();
+        int index = reclaimer->enter();
+
+        Node* preds[max_level];
+        Node* succs[max_level];
+        bool removed = false;
+        if (find(key, preds, succs)) {
+            Node* node = succs[0];
+            for (int level = node->height - 1; level > 0; --level) {
+                Node* next = node->next(level).load(std::memory_order_acquire);
+                while (!is_remove(next) && !node->next(level).compare_exchange_weak(next, mark(next), std::memory_order_acq_rel)) {}
+            }
+            Node* next = node->next(0).load(std::memory_order_acquire);
+            while (!is_remove(next)) {
+                if (node->next(0).compare_exchange_weak(next, mark(next), std::memory_order_acq_rel)) {
+                    removed = true;
+                    break;
+                }
+            }
+            if (removed) {
+                element_count.fetch_sub(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                find(key, preds, succs);
+                release(node);
+            }
+        }
+
+        reclaimer->leave(index);
+        return removed;
+    }
+
+    uint64_t size() const {
+        return element_count.load(std::memory_order_relaxed);
+    }
+
+};
\ No newline at end of file
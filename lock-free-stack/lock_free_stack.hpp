@@ -1,37 +1,97 @@
+#pragma once
+
 #include <iostream>
 #include <cassert>
 #include <atomic>
 
 #include "../lock-free-memorypool/lock_free_memorypool.hpp"
+#include "../lock-free-common/lock_free_tagged_head.hpp"
 
+//Treiber stack linked through 32 bit pool indices under a LockFreeTaggedHead
+//with elimination slots (Hendler, Shavit, Yerushalmi) a push whose CAS on top failed parks its node in a random slot
+//for a short while, and a pop whose CAS failed takes a parked node from a slot without touching top
 template<typename T>
 class LockFreeStack {
 
 private:
     struct Node {
         T data;
-        Node* next;
+        std::atomic<uint32_t> next;
+    };
+
+    //slot word: empty, offered | node index while a push waits, taken once a pop claimed the node
+    struct alignas(64) Exchanger {
+        std::atomic<uint64_t> word;
     };
 
-    std::atomic<uint64_t> top;
+    static constexpr uint32_t null_index = LockFreeTaggedHead::null_index;
+
+    static constexpr uint64_t empty = 0;
+    static constexpr uint64_t offered = 1ull << 32;
+    static constexpr uint64_t taken = 2ull << 32;
+    static constexpr uint32_t min_spins = 16;
+    static constexpr uint32_t max_spins = 1024;
+
+    LockFreeTaggedHead top;
     LockFreeMemoryPool<Node>* pool;
 
-    static constexpr uint64_t ptr_mask = 0x0000ffffffffffff;
+    //nullptr when elimination is off, width is how many of the slots are in use right now
+    Exchanger* exchangers;
+    uint32_t exchanger_count;
+    std::atomic<uint32_t> width;
 
 private:
 
-    uint64_t pack(Node* node, uint16_t version) {
-        uint64_t v = version;
-        uint64_t ptr = reinterpret_cast<uint64_t>(node);
-        return (v << 48) | (ptr & ptr_mask);
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
     }
 
-    Node* unpackPtr(uint64_t combined) {
-        return reinterpret_cast<Node*>(combined & ptr_mask);
+    static uint32_t random_slot(uint32_t range) {
+        static thread_local uint32_t seed = 0x9e3779b9u ^ uint32_t(reinterpret_cast<uintptr_t>(&seed));
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed % range;
     }
 
-    uint16_t unpackVersion(uint64_t combined) {
-        return combined >> 48;
+    //a busy slot means many pushes are eliminating at once so the range widens,
+    //an offer nobody took means partners are rare so the range narrows to make them meet
+    bool eliminate_push(uint32_t index, uint32_t spins) {
+        uint32_t w = width.load(std::memory_order_relaxed);
+        Exchanger& exchanger = exchangers[random_slot(w)];
+        uint64_t expected = empty;
+        if (exchanger.word.compare_exchange_strong(expected, offered | index, std::memory_order_release, std::memory_order_relaxed) == false) {
+            if (w < exchanger_count) width.compare_exchange_weak(w, w * 2 < exchanger_count ? w * 2 : exchanger_count, std::memory_order_relaxed);
+            return false;
+        }
+        for (uint32_t i = 0; i < spins; ++i) {
+            if (exchanger.word.load(std::memory_order_acquire) == taken) {
+                exchanger.word.store(empty, std::memory_order_release);
+                return true;
+            }
+            cpu_relax();
+        }
+        expected = offered | index;
+        if (exchanger.word.compare_exchange_strong(expected, empty, std::memory_order_relaxed)) {
+            if (w > 1) width.compare_exchange_weak(w, w / 2, std::memory_order_relaxed);
+            return false;
+        }
+        //taken between the last check and the withdraw
+        exchanger.word.store(empty, std::memory_order_release);
+        return true;
+    }
+
+    bool eliminate_pop(T& val) {
+        Exchanger& exchanger = exchangers[random_slot(width.load(std::memory_order_relaxed))];
+        uint64_t word = exchanger.word.load(std::memory_order_acquire);
+        if ((word & ~uint64_t(null_index)) != offered) return false;
+        if (exchanger.word.compare_exchange_strong(word, taken, std::memory_order_acq_rel, std::memory_order_relaxed) == false) return false;
+        uint32_t index = uint32_t(word);
+        val = pool->at(index)->data;
+        pool->deallocate_index(index);
+        return true;
     }
 
 public:
@@ -46,40 +106,56 @@ public:
 
     LockFreeStack& operator = (const LockFreeStack&&) = delete;
 
-    explicit LockFreeStack(uint32_t size):top(pack(nullptr, 0)), pool(new LockFreeMemoryPool<Node>(size)) {};
+    //magazine_size > 0 gives every thread its own node cache, see LockFreeMemoryPool
+    //elimination > 0 turns on an elimination array of up to that many slots, worth it only under heavy push/pop contention
+    explicit LockFreeStack(uint32_t size, uint32_t magazine_size = 0, uint32_t elimination = 0):top(null_index), pool(new LockFreeMemoryPool<Node>(size, magazine_size)) {
+        exchanger_count = elimination;
+        exchangers = elimination ? new Exchanger[elimination] : nullptr;
+        for (uint32_t i = 0; i < exchanger_count; ++i) {
+            exchangers[i].word.store(empty, std::memory_order_relaxed);
+        }
+        width.store(1, std::memory_order_relaxed);
+    }
+
+    ~LockFreeStack() {
+        delete[] exchangers;
+        delete pool;
+    }
 
     bool pop(T& val) {
-        uint64_t old_top;
-        uint64_t nex_top;
+        LockFreeTaggedHead::Value old_top = top.load();
         Node* node;
-        do {
-            old_top = top.load(std::memory_order_acquire);
-            node = unpackPtr(old_top);
-            if (node == nullptr) return false;
-            nex_top = pack(node->next, unpackVersion(old_top) + 1);
-        } while (top.compare_exchange_strong(old_top, nex_top, std::memory_order_acq_rel) == false);
+        while (true) {
+            if (old_top.index == null_index) return false;
+            node = pool->at(old_top.index);
+            if (top.compare_exchange(old_top, node->next.load(std::memory_order_relaxed))) break;
+            if (exchangers && eliminate_pop(val)) return true;
+        }
         val = node->data;
-        pool->deallocate(node);
+        pool->deallocate_index(old_top.index);
         return true;
     }
 
     void push(const T& val) {
-        Node* node = pool->allocate();
-        if (node == nullptr) {
+        uint32_t index = pool->allocate_index();
+        if (index == null_index) {
             std::cerr << "Pool size is too small\n";
             exit(0);
         }
+        Node* node = pool->at(index);
         node->data = val;
 
-        uint64_t new_top, cur_top;
-        uint16_t v;
-
-        do {
-            cur_top = top.load(std::memory_order_acquire);
-            v = unpackVersion(cur_top) + 1;
-            node->next = unpackPtr(cur_top);
-            new_top = pack(node, v);
-        } while (top.compare_exchange_strong(cur_top, new_top, std::memory_order_acq_rel) == false);
+        uint32_t spins = min_spins;
+        LockFreeTaggedHead::Value cur_top = top.load();
+        while (true) {
+            node->next.store(cur_top.index, std::memory_order_relaxed);
+            if (top.compare_exchange(cur_top, index)) return;
+            if (exchangers) {
+                if (eliminate_push(index, spins)) return;
+                if (spins < max_spins) spins *= 2;
+                cur_top = top.load();
+            }
+        }
     }
 
 };
\ No newline at end of file
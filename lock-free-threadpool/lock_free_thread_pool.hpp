@@ -0,0 +1,320 @@
+#pragma once
+
+#include <iostream>
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <thread>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+
+#include "../lock-free-deque/lock_free_deque.hpp"
+#include "../lock-free-ringbuffer/lock_free_ringbuffer.hpp"
+#include "../lock-free-memorypool/lock_free_memorypool.hpp"
+
+//work stealing executor: every worker owns a LockFreeDeque, tasks spawned by a worker go to the bottom of its own deque
+//and it runs them newest first, idle workers steal the oldest task of a random victim
+//tasks submitted from outside the pool go through an MPMC LockFreeRingBuffer that every worker polls
+//tasks live in a LockFreeMemoryPool with per thread magazines, so spawning a task takes no shared CAS
+//workers that found nothing for a while park on a futex and spawning only wakes one when somebody sleeps,
+//the parking side pays for the store-load ordering with a membarrier so spawning only needs a compiler fence
+//fork join: tasks submitted into a Group are waited for with wait(group), which runs other tasks meanwhile
+//and parks like an idle worker once there are none, the task that finishes a group wakes its waiters,
+//tasks must not throw
+class LockFreeThreadPool {
+
+public:
+
+    struct Group {
+        std::atomic<uint64_t> pending{0};
+    };
+
+private:
+
+    struct Task {
+        std::function<void()> fn;
+        Group* group;
+    };
+
+    struct alignas(64) Worker {
+        LockFreeDeque<Task*>* deque;
+        std::thread* thread;
+        uint64_t seed;
+    };
+
+    struct Context {
+        LockFreeThreadPool* pool;
+        Worker* worker;
+    };
+
+    static constexpr uint32_t deque_capacity = 256;
+    static constexpr uint32_t task_magazine = 64;
+    //rounds without finding a task before a worker parks
+    static constexpr uint32_t idle_rounds = 64;
+
+    uint32_t worker_count;
+    Worker* workers;
+    LockFreeRingBuffer<Task*>* injection;
+    LockFreeMemoryPool<Task>* tasks;
+
+    alignas(64) std::atomic<uint32_t> signal;
+    std::atomic<uint32_t> sleepers;
+    //the sleepers parked in wait(group), they also need a wake when a group finishes
+    std::atomic<uint32_t> joiners;
+    std::atomic<bool> stop;
+    //private expedited membarrier is available, see light_barrier
+    bool asymmetric;
+
+private:
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    static void futex_wait(std::atomic<uint32_t>* addr, uint32_t val) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t>* addr, uint32_t count) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, count > INT_MAX ? INT_MAX : count, nullptr, nullptr, 0);
+    }
+
+    static Context& context() {
+        static thread_local Context ctx = {nullptr, nullptr};
+        return ctx;
+    }
+
+    //the calling thread's worker, nullptr outside this pool
+    Worker* self() {
+        Context& ctx = context();
+        return ctx.pool == this ? ctx.worker : nullptr;
+    }
+
+    //with membarrier the fence between publishing and checking for sleepers is only a compiler fence,
+    //park's heavy barrier makes every running thread's stores visible instead, without it both sides fence
+    void light_barrier() {
+        if (asymmetric) std::atomic_signal_fence(std::memory_order_seq_cst);
+        else std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void heavy_barrier() {
+        if (asymmetric) syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        else std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    //pairs with the barrier in park: either the sleeper's last look finds the new task or this sees the sleeper
+    void notify() {
+        light_barrier();
+        if (sleepers.load(std::memory_order_relaxed) == 0) return;
+        signal.fetch_add(1, std::memory_order_release);
+        futex_wake(&signal, 1);
+    }
+
+    //a group just finished, pairs with park the same way: the joiner sees pending at 0 or this sees the joiner
+    void notify_joiners() {
+        light_barrier();
+        if (joiners.load(std::memory_order_relaxed) == 0) return;
+        signal.fetch_add(1, std::memory_order_release);
+        futex_wake(&signal, INT_MAX);
+    }
+
+    void spawn(Group* group, std::function<void()>&& fn) {
+        Task* task = tasks->allocate();
+        if (task == nullptr) {
+            std::cerr << "Memory allocation failed for lock free thread pool\n";
+            exit(0);
+        }
+        task->fn = std::move(fn);
+        task->group = group;
+        Worker* worker = self();
+        if (worker) worker->deque->push(task);
+        else injection->enqueue_wait(task);
+        notify();
+    }
+
+    void run(Task* task) {
+        task->fn();
+        Group* group = task->group;
+        task->fn = nullptr;
+        tasks->deallocate(task);
+        //the group may be gone as soon as pending drops to 0
+        if (group && group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) notify_joiners();
+    }
+
+    //own deque first, then the injection queue, then one pass over the other workers from a random one
+    bool find_task(Worker* worker, Task*& task) {
+        if (worker && worker->deque->pop(task)) return true;
+        if (injection->dequeue(task)) return true;
+        uint32_t start = 0;
+        if (worker) {
+            worker->seed ^= worker->seed << 13;
+            worker->seed ^= worker->seed >> 7;
+            worker->seed ^= worker->seed << 17;
+            start = worker->seed % worker_count;
+        }
+        for (uint32_t i = 0; i < worker_count; ++i) {
+            Worker* victim = &workers[(start + i) % worker_count];
+            if (victim != worker && victim->deque->steal(task)) return true;
+        }
+        return false;
+    }
+
+    //sleep until notify, unless a last look after announcing the sleep finds a task or group is done already
+    bool park(Worker* worker, Task*& task, Group* group = nullptr) {
+        uint32_t word = signal.load(std::memory_order_acquire);
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        if (group) joiners.fetch_add(1, std::memory_order_seq_cst);
+        heavy_barrier();
+        bool found = find_task(worker, task);
+        bool done = group && group->pending.load(std::memory_order_acquire) == 0;
+        if (!found && !done && !stop.load(std::memory_order_acquire)) futex_wait(&signal, word);
+        if (group) joiners.fetch_sub(1, std::memory_order_relaxed);
+        sleepers.fetch_sub(1, std::memory_order_relaxed);
+        return found;
+    }
+
+    void work(Worker* worker) {
+        context() = {this, worker};
+        uint32_t idle = 0;
+        while (true) {
+            Task* task;
+            if (find_task(worker, task)) {
+                run(task);
+                idle = 0;
+                continue;
+            }
+            if (stop.load(std::memory_order_acquire)) break;
+            if (++idle < idle_rounds) {
+                cpu_relax();
+                continue;
+            }
+            if (idle < idle_rounds * 2) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (park(worker, task)) run(task);
+            idle = 0;
+        }
+        context() = {nullptr, nullptr};
+    }
+
+    template<typename Fn>
+    void split(Group& group, uint64_t begin, uint64_t end, uint64_t grain, Fn& fn) {
+        while (end - begin > grain) {
+            uint64_t mid = begin + (end - begin) / 2;
+            submit(group, [this, &group, mid, end, grain, &fn] {
+                split(group, mid, end, grain, fn);
+            });
+            end = mid;
+        }
+        for (uint64_t i = begin; i < end; ++i) {
+            fn(i);
+        }
+    }
+
+public:
+
+    LockFreeThreadPool() = delete;
+
+    LockFreeThreadPool(const LockFreeThreadPool&) = delete;
+
+    LockFreeThreadPool(const LockFreeThreadPool&&) = delete;
+
+    LockFreeThreadPool& operator = (const LockFreeThreadPool&) = delete;
+
+    LockFreeThreadPool& operator = (const LockFreeThreadPool&&) = delete;
+
+    //queue_size bounds the tasks submitted from outside and not yet picked up, pow of 2, submit blocks while it is full
+    explicit LockFreeThreadPool(uint32_t threads, uint32_t queue_size = 1024) {
+        assert(threads > 0);
+        worker_count = threads;
+        signal.store(0, std::memory_order_relaxed);
+        sleepers.store(0, std::memory_order_relaxed);
+        joiners.store(0, std::memory_order_relaxed);
+        stop.store(false, std::memory_order_relaxed);
+        asymmetric = syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+        injection = new LockFreeRingBuffer<Task*>(queue_size);
+        tasks = new LockFreeMemoryPool<Task>(deque_capacity * threads, task_magazine);
+        workers = new Worker[worker_count];
+        for (uint32_t i = 0; i < worker_count; ++i) {
+            workers[i].deque = new LockFreeDeque<Task*>(deque_capacity);
+            workers[i].seed = 0x9e3779b97f4a7c15ull * (i + 1);
+        }
+        for (uint32_t i = 0; i < worker_count; ++i) {
+            workers[i].thread = new std::thread([this, i] { work(&workers[i]); });
+        }
+    }
+
+    //runs every task already submitted, then joins the workers
+    ~LockFreeThreadPool() {
+        stop.store(true, std::memory_order_release);
+        signal.fetch_add(1, std::memory_order_release);
+        futex_wake(&signal, INT_MAX);
+        for (uint32_t i = 0; i < worker_count; ++i) {
+            workers[i].thread->join();
+            delete workers[i].thread;
+        }
+        for (uint32_t i = 0; i < worker_count; ++i) {
+            delete workers[i].deque;
+        }
+        delete[] workers;
+        delete injection;
+        delete tasks;
+    }
+
+    uint32_t threads() const {
+        return worker_count;
+    }
+
+    template<typename Fn>
+    void submit(Fn&& fn) {
+        spawn(nullptr, std::function<void()>(std::forward<Fn>(fn)));
+    }
+
+    template<typename Fn>
+    void submit(Group& group, Fn&& fn) {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        spawn(&group, std::function<void()>(std::forward<Fn>(fn)));
+    }
+
+    //returns once every task submitted into group has run, running other tasks meanwhile, also callable from outside the pool
+    //with nothing left to run it spins, yields and then parks until a task shows up or the group finishes
+    void wait(Group& group) {
+        Worker* worker = self();
+        uint32_t idle = 0;
+        while (group.pending.load(std::memory_order_acquire) != 0) {
+            Task* task;
+            if (find_task(worker, task)) {
+                run(task);
+                idle = 0;
+                continue;
+            }
+            if (++idle < idle_rounds) {
+                cpu_relax();
+                continue;
+            }
+            if (idle < idle_rounds * 2) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (park(worker, task, &group)) run(task);
+            idle = 0;
+        }
+    }
+
+    //fn(i) for every i in [begin, end), the range is split in halves down to grain indices per task
+    template<typename Fn>
+    void parallel_for(uint64_t begin, uint64_t end, uint64_t grain, Fn&& fn) {
+        if (begin >= end) return;
+        if (grain == 0) grain = 1;
+        Group group;
+        split(group, begin, end, grain, fn);
+        wait(group);
+    }
+
+};
\ No newline at end of file